@@ -16,20 +16,28 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-.equ FS_BASE, 0xffff000030000000
-.equ FS_SIZE, 101*16*63*512 // Num of cylinders * num of heads * num of sectors per track * block size
-
 .section .text
 .global _start
+.global secondary_entry
+.global idle
 
 _start:
     mrs x0, mpidr_el1
     # get the lower 2 bits of the x0 register
     and x0, x0, #3
-    # check if value is 0 (CPU0). We are building this kernel to run on CPU0 core only
+    # check if value is 0 (CPU0). The boot core brings up the kernel and releases the other cores later on
     cmp x0, #0      
     beq kernel_entry
 
+    # Secondary cores which enter here along with the boot core wait on the same spin table the firmware parks them on otherwise
+    # It holds an 8-byte entry address per core from 0xd8 onwards, written by the boot core once the kernel is up (see start_secondary_cores)
+    mov x1, #0xd8
+pen:
+    wfe
+    ldr x2, [x1, x0, lsl #3]
+    cbz x2, pen
+    br x2
+
 end:
     # Equivalent to a NOP except that the system has stopped or stalled
     b end               
@@ -67,15 +75,8 @@ el1_entry:
     bl setup_vm
     bl enable_mmu
 
-    # Use memcpy to extract and load the filesystem appended to the kernel image just after the kernel end
-    # The bss section does not have space reserved in kernel image file on the disk and bss start can have padding
-    # We can extract the FAT16 disk image immediately after data section ends which also marks end of kernel image on disk
-    # Once we copy the fs in desired location, the bss segment is set up with memset in memory
-    ldr x0, =FS_BASE
-    ldr x1, =disk_img_end
-    ldr x2, =FS_SIZE
-    bl memcpy
-
+    # The FAT16 disk image appended to the kernel image starts right after the data section (disk_img_end) and is used in place
+    # The linker script places the bss segment past the end of the disk image hence zeroing it leaves the filesystem intact
     # Load start address of bss in register x0 and end address in x1
     ldr x0, =bss_start
     ldr x1, =bss_end
@@ -92,12 +93,59 @@ el1_entry:
     mov x0, #0xffff000000000000
     add sp, sp, x0
 
-    # Get the virtual address of the kernel main function
+    # Get the virtual address of the kernel main function and branch to it
+    # It returns to the idle loop at its virtual address as well, since the identity mapping in ttbr0 does not outlive the boot
+    ldr x30, =idle
     ldr x0, =kmain
-    # Branch from register to kernel main
-    blr x0
+    br x0
+
+secondary_entry:
+    # Secondary cores are released here at the physical address with the MMU off, in the same state as the boot core
+    mrs x0, currentel
+    lsr x0, x0, #2
+    cmp x0, #2
+    bne end
+
+    # Drop to EL1 with interrupts masked the same way as the boot core does
+    msr sctlr_el1, xzr
+    mov x0, #1
+    lsl x0, x0, #31
+    msr hcr_el2, x0
+    mov x0, #0b1111000101
+    msr spsr_el2, x0
+    adr x0, secondary_el1_entry
+    msr elr_el2, x0
+
+    eret
+
+secondary_el1_entry:
+    # Each core gets a 64K boot stack below the one of the boot core at 0x80000, which serves as the kernel stack of its idle process
+    mrs x0, mpidr_el1
+    and x0, x0, #3
+    mov x1, #0x80000
+    sub x1, x1, x0, lsl #16
+    mov sp, x1
+
+    # The page tables were set up by the boot core. Only turn on paging with them on this core
+    bl enable_mmu
+
+    ldr x0, =vector_table
+    msr vbar_el1, x0
+
+    mov x0, #0xffff000000000000
+    add sp, sp, x0
+
+    # Set up the core and continue in its idle loop at the virtual address
+    ldr x30, =idle
+    ldr x0, =secondary_main
+    br x0
 
 idle:
+    # Zero free pages into the pre-zeroed pool while there is nothing else to run
+    # A shutdown event arriving during this call may not survive in x5 hence the call reports a pending shutdown itself
+    bl idle_work
+    cmp x0, #1
+    beq halt
     # Wait for interrupt and suspend execution
     # This is normally the point where the mode will switch to EL0 (userspace) on occurence of a timer interrupt
     # The idle process (PID 0) when running, resumes here when it finishes servicing outstanding interrupts
@@ -108,7 +156,11 @@ idle:
     b idle
 
 halt:
+    # The banner is printed by the boot core alone
+    bl cpu_id
+    cbnz x0, park
     bl shutdown_banner
+park:
     # Disable all interrupts
     msr daifset, #2
     b end
@@ -18,6 +18,11 @@
 
 #include "debug.h"
 #include <io/print.h>
+#ifdef MEMBENCH
+#include <lib/lib.h>
+#include <irq/handler.h>
+#include <memory/memory.h>
+#endif
 
 void error_check(char *filename, uint64_t line)
 {
@@ -27,4 +32,74 @@ void error_check(char *filename, uint64_t line)
     printk("Assertion Failed [%s: %u]\r\n", filename, line);
 
     while(1);
-}
\ No newline at end of file
+}
+
+#ifdef MEMBENCH
+#define BENCH_BYTES 0x800000 /* Amount of data moved for every measurement (8M) */
+
+/* Byte at a time baseline routines (see lib_asm.s) */
+void memset_byte(void* dst, int value, unsigned int size);
+void memcpy_byte(void* dst, void* src, unsigned int size);
+int memcmp_byte(void* src1, void* src2, unsigned int size);
+
+enum En_BenchOp
+{
+    BENCH_MEMSET = 0,
+    BENCH_MEMCPY,
+    BENCH_MEMCMP
+};
+
+/* Time moving BENCH_BYTES in chunks of a given size with the byte or the optimized routine
+   @return Elapsed time in microseconds */
+static uint64_t bench(int op, bool byte, char* dst, char* src, uint32_t size)
+{
+    uint64_t start = read_counter();
+
+    for (uint32_t done = 0; done < BENCH_BYTES; done += size)
+    {
+        switch (op)
+        {
+        case BENCH_MEMSET:
+            byte ? memset_byte(dst, 0, size) : memset(dst, 0, size);
+            break;
+        case BENCH_MEMCPY:
+            byte ? memcpy_byte(dst, src, size) : memcpy(dst, src, size);
+            break;
+        case BENCH_MEMCMP:
+            byte ? memcmp_byte(dst, src, size) : memcmp(dst, src, size);
+            break;
+        }
+    }
+
+    return (read_counter() - start) * 1000000 / read_timer_freq();
+}
+
+/* Compare the optimized memory routines with the byte at a time loops they replaced, for small, page and block sized
+   chunks with the source aligned and misaligned. Built in with MEMBENCH=1 and run once at boot */
+void mem_benchmark(void)
+{
+    const char* names[] = {"memset", "memcpy", "memcmp"};
+    const uint32_t sizes[] = {64, FRAME_SIZE, PAGE_SIZE};
+    char* dst = kalloc();
+    char* src = kalloc();
+
+    ASSERT(dst != NULL && src != NULL);
+    memset(src, 0, PAGE_SIZE);
+    printk("Memory routine benchmark (%u bytes per run, time in us)\n", BENCH_BYTES);
+    for (int op = BENCH_MEMSET; op <= BENCH_MEMCMP; op++)
+    {
+        for (int i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++)
+        {
+            for (int misalign = 0; misalign <= 1; misalign++)
+            {
+                /* The misaligned source leaves the last chunk one byte short to stay within the block */
+                uint32_t size = sizes[i] - misalign;
+                printk("%s\tsize %u\tmisalign %u\tbyte %u\toptimized %u\n", names[op], size, misalign,
+                       (uint32_t)bench(op, true, dst, src + misalign, size), (uint32_t)bench(op, false, dst, src + misalign, size));
+            }
+        }
+    }
+    kfree((uint64_t)dst);
+    kfree((uint64_t)src);
+}
+#endif
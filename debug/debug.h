@@ -26,5 +26,8 @@
 } while (0)
 
 void error_check(char* filename, uint64_t line);
+#ifdef MEMBENCH
+void mem_benchmark(void);
+#endif
 
 #endif
\ No newline at end of file
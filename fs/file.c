@@ -18,13 +18,16 @@
 
 #include "file.h"
 #include <memory/memory.h>
+#include <memory/slab.h>
 #include <io/print.h>
 #include <lib/lib.h>
 #include <debug/debug.h>
 #include <process/process.h>
 
-static struct Inode* inode_table;
-static struct FileEntry* global_file_table;
+/* In core inodes indexed by root directory entry index. An entry is NULL while the file is not open */
+static struct Inode** inode_table;
+static struct KmemCache* inode_cache;
+static struct KmemCache* file_cache;
 
 static struct BPB* get_fs_bpb(void)
 {
@@ -163,7 +166,7 @@ static uint32_t search_file(char *path)
     return dir_index;
 }
 
-static uint32_t read_raw_data(uint32_t cluster_index, char *buf, uint32_t offset, uint32_t size)
+uint32_t read_raw_data(uint32_t cluster_index, char *buf, uint32_t offset, uint32_t size)
 {
     char *data;
     uint32_t read_size = 0;
@@ -211,6 +214,41 @@ static uint32_t read_raw_data(uint32_t cluster_index, char *buf, uint32_t offset
     return read_size;
 }
 
+/* Find the file data at a given offset in the filesystem image. The file is walked forward from a cluster cursor which the caller
+   keeps between calls so that consecutive lookups through a large file do not walk its cluster chain from the start every time
+   @param cluster_index In, the cluster of the cursor. Out, the cluster holding offset
+   @param cluster_base In, the file offset at which the cursor cluster starts. Out, the file offset at which the cluster holding offset starts
+   @return Kernel address of the data at offset if the clusters holding size bytes from it follow one another in the image, 0 otherwise */
+uint64_t get_data_addr(uint32_t* cluster_index, uint32_t* cluster_base, uint32_t offset, uint32_t size)
+{
+    struct BPB* bpb = get_fs_bpb();
+    uint32_t cluster_size = get_cluster_size();
+    uint32_t index, last;
+
+    ASSERT(offset >= *cluster_base);
+    while (offset - *cluster_base >= cluster_size)
+    {
+        if (*cluster_index < FAT_RESERVED_BYTES || *cluster_index == END_OF_DATA)
+            return 0;
+        *cluster_index = get_next_cluster_index(*cluster_index);
+        *cluster_base += cluster_size;
+    }
+    if (*cluster_index < FAT_RESERVED_BYTES || *cluster_index == END_OF_DATA)
+        return 0;
+
+    /* Every cluster up to the one holding the last byte must be the successor of the previous one in the image */
+    index = *cluster_index;
+    last = (offset - *cluster_base + size - 1) / cluster_size;
+    for (uint32_t i = 0; i < last; i++)
+    {
+        if (get_next_cluster_index(index) != index + 1)
+            return 0;
+        index++;
+    }
+
+    return (uint64_t)bpb + get_cluster_offset(*cluster_index) + (offset - *cluster_base);
+}
+
 uint32_t read_file(struct Process* process, int fd, void *buf, uint32_t size)
 {
     uint32_t offset = process->fd_table[fd]->offset;
@@ -228,24 +266,30 @@ uint32_t read_file(struct Process* process, int fd, void *buf, uint32_t size)
     return read_size;
 }
 
-int get_inode_entry(uint32_t dir_entry_index)
+static struct Inode* get_inode_entry(uint32_t dir_entry_index)
 {
     struct DirEntry* dir_table;
-    /* Cache the file metadata to an in core inode if it is free (ref_count == 0) */
-    if (inode_table[dir_entry_index].ref_count == 0){
+    struct Inode* inode = inode_table[dir_entry_index];
+
+    /* Cache the file metadata to a new in core inode if the file is not open yet */
+    if (inode == NULL){
+        inode = kmem_cache_alloc(inode_cache);
+        if (inode == NULL)
+            return NULL;
         dir_table = get_root_dir_section();
         /* Currently we work with a paradigm where the FAT16 root dir index is used as the in core inode table index */
-        inode_table[dir_entry_index].dir_index = dir_entry_index;
-        inode_table[dir_entry_index].file_size = dir_table[dir_entry_index].file_size;
-        inode_table[dir_entry_index].cluster_index = dir_table[dir_entry_index].cluster_index;
-        memcpy(inode_table[dir_entry_index].name, dir_table[dir_entry_index].name, MAX_FILENAME_BYTES);
-        memcpy(inode_table[dir_entry_index].ext, dir_table[dir_entry_index].ext, MAX_EXTNAME_BYTES);
+        inode->dir_index = dir_entry_index;
+        inode->file_size = dir_table[dir_entry_index].file_size;
+        inode->cluster_index = dir_table[dir_entry_index].cluster_index;
+        memcpy(inode->name, dir_table[dir_entry_index].name, MAX_FILENAME_BYTES);
+        memcpy(inode->ext, dir_table[dir_entry_index].ext, MAX_EXTNAME_BYTES);
+        inode_table[dir_entry_index] = inode;
     }
 
     /* Increment the reference count of the in core inode */
-    inode_table[dir_entry_index].ref_count++;
+    inode->ref_count++;
 
-    return dir_entry_index;
+    return inode;
 }
 
 uint32_t get_file_size(struct Process* process, int fd)
@@ -253,11 +297,16 @@ uint32_t get_file_size(struct Process* process, int fd)
     return process->fd_table[fd]->inode->file_size;
 }
 
+uint32_t get_file_cluster(struct Process* process, int fd)
+{
+    return process->fd_table[fd]->inode->cluster_index;
+}
+
 int open_file(struct Process* process, char* pathname)
 {
     int fd = -1;
-    int file_table_index = -1;
-    uint32_t dir_entry_index, inode_table_index;
+    uint32_t dir_entry_index;
+    struct FileEntry* file_entry;
 
     /* Find the first free entry in the user file descriptor table of the process */
     for(int i = 0; i < MAX_OPEN_FILES; i++)
@@ -270,30 +319,24 @@ int open_file(struct Process* process, char* pathname)
     if (fd == -1)
         return fd;
 
-    /* Next find first free entry (entry not pointing to any inode) in the global file table */
-    for(int i = 0; i < PAGE_SIZE / sizeof(struct FileEntry); i++)
-    {
-        if (global_file_table[i].inode == NULL){
-            file_table_index = i;
-            break;
-        }
-    }
-    /* If no entry available in file table, the open operation fails */
-    if (file_table_index == -1)
-        return -1;
-
     dir_entry_index = search_file(pathname);
     if (DIR_ENTRY_INVALID == dir_entry_index)
         return -1;
 
-    inode_table_index = get_inode_entry(dir_entry_index);
-    memset(global_file_table + file_table_index, 0, sizeof(struct FileEntry));
-    /* An open call will always create a new file table entry. Hence we initialize the ref count to 1 */
-    global_file_table[file_table_index].ref_count = 1;
-    /* Link the in core inode to the global file table entry */
-    global_file_table[file_table_index].inode = inode_table + inode_table_index;
+    /* An open call will always create a new file table entry. If none can be allocated, the open operation fails */
+    file_entry = kmem_cache_alloc(file_cache);
+    if (file_entry == NULL)
+        return -1;
+    /* Link the in core inode to the file table entry */
+    file_entry->inode = get_inode_entry(dir_entry_index);
+    if (file_entry->inode == NULL){
+        kmem_cache_free(file_cache, file_entry);
+        return -1;
+    }
+    /* The new file table entry is referred to by this descriptor alone. Hence we initialize the ref count to 1 */
+    file_entry->ref_count = 1;
     /* Link the file table entry to the process file descriptor table */
-    process->fd_table[fd] = global_file_table + file_table_index;
+    process->fd_table[fd] = file_entry;
 
     return fd;
 }
@@ -307,25 +350,39 @@ static void inode_put(struct Inode* inode)
     ASSERT(inode->ref_count > 0);
     inode->ref_count--;
     /* Release the in core inode if it's not referring to any file */
-    if (inode->ref_count == 0)
-        inode = NULL;
+    if (inode->ref_count == 0){
+        inode_table[inode->dir_index] = NULL;
+        kmem_cache_free(inode_cache, inode);
+    }
+}
+
+/* Take another reference to an open file shared through a duplicated descriptor table (see fork) */
+void file_get(struct FileEntry* file_entry)
+{
+    file_entry->ref_count++;
+    file_entry->inode->ref_count++;
 }
 
 void close_file(struct Process* process, int fd)
 {
-    if (fd < 0 || process->fd_table[fd] == NULL)
+    struct FileEntry* file_entry;
+
+    if (fd < 0 || fd >= MAX_OPEN_FILES || process->fd_table[fd] == NULL)
         return;
     
+    file_entry = process->fd_table[fd];
+    /* The descriptor is closed for this process regardless of whether other processes share the file table entry */
+    process->fd_table[fd] = NULL;
     /* Algorithm iput => unlink the inode by decrementing reference count */
-    inode_put(process->fd_table[fd]->inode);
+    inode_put(file_entry->inode);
 
-    /* Unlink the file table entry by decrementing reference count */
-    process->fd_table[fd]->ref_count--;
-    /* Free the file table entry if the ref count is zero. File table entry ref count may not always be zero
+    /* Unlink the file table entry by decrementing reference count. File table entry ref count may not always drop to zero
        There could be occasions like a fork system call causing file table entry to be shared by the parent with the child
        This is different from the inode reference count which keeps a count of all processes accessing a file */
-    if (process->fd_table[fd]->ref_count == 0)
-        process->fd_table[fd] = NULL;
+    file_entry->ref_count--;
+    /* Free the file table entry once no descriptor refers to it */
+    if (file_entry->ref_count == 0)
+        kmem_cache_free(file_cache, file_entry);
 }
 
 int read_root_dir_table(char* buf)
@@ -338,26 +395,38 @@ int read_root_dir_table(char* buf)
     return count;
 }
 
+/* Objects handed out by the inode and file table caches start off zeroed */
+static void zero_inode(void* obj)
+{
+    memset(obj, 0, sizeof(struct Inode));
+}
+
+static void zero_file_entry(void* obj)
+{
+    memset(obj, 0, sizeof(struct FileEntry));
+}
+
 bool init_inode_table(void)
 {
-    inode_table = (struct Inode*)kalloc();
-    if (inode_table == NULL)
+    /* The root directory entry index doubles as the in core inode table index hence size the table accordingly */
+    uint32_t size = get_root_dir_count() * sizeof(struct Inode*);
+
+    inode_cache = kmem_cache_create("inode", sizeof(struct Inode), zero_inode);
+    inode_table = (struct Inode**)kmalloc(size);
+    if (inode_cache == NULL || inode_table == NULL)
         return false;
 
-    memset(inode_table, 0, PAGE_SIZE);
+    memset(inode_table, 0, size);
 
     return true;
 }
 
 bool init_file_table(void)
 {
-    global_file_table = (struct FileEntry*)kalloc();
-    if (global_file_table == NULL)
-        return false;
+    /* File table entries are allocated on open and released on the last close */
+    file_cache = kmem_cache_create("file", sizeof(struct FileEntry), zero_file_entry);
 
-    memset(global_file_table, 0, PAGE_SIZE);
-
-    return true;
+    return file_cache != NULL;
 }
 
 void init_fs(void)
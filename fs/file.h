@@ -79,7 +79,8 @@ struct FileEntry
 
 #define UPPER_BOUND(x,a)    (((x)+(a-1)) & ~(a-1))
 
-#define FS_BASE TO_VIRT(0x30000000)
+extern char disk_img_end[];
+#define FS_BASE ((uint64_t)disk_img_end) /* The disk image appended to the kernel image is used where the bootloader loaded it */
 #define BYTES_PER_SECTOR 512
 #define PARTITION_ENTRY_OFFSET 0x1be
 #define LBA_OFFSET 8
@@ -104,8 +105,12 @@ struct Process;
 void init_fs(void);
 int open_file(struct Process* process, char* pathname);
 void close_file(struct Process* process, int fd);
+void file_get(struct FileEntry* file_entry);
 uint32_t get_file_size(struct Process* process, int fd);
+uint32_t get_file_cluster(struct Process* process, int fd);
 uint32_t read_file(struct Process* process, int fd, void *buf, uint32_t size);
+uint32_t read_raw_data(uint32_t cluster_index, char *buf, uint32_t offset, uint32_t size);
+uint64_t get_data_addr(uint32_t* cluster_index, uint32_t* cluster_base, uint32_t offset, uint32_t size);
 int read_root_dir_table(char* buf);
 
 #endif
\ No newline at end of file
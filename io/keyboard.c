@@ -20,23 +20,33 @@
 #include "uart.h"
 #include "print.h"
 #include <process/process.h>
+#include <process/workqueue.h>
+
+static void process_keys(struct Work* work);
 
 static struct KeyBuffer key_buf = {
     .buf = {0},
     .front = 0,
     .end = 0,
 };
+/* Keys received by the UART interrupt handler and yet to be acted on by the bottom half */
+static struct KeyBuffer rx_buf = {
+    .buf = {0},
+    .front = 0,
+    .end = 0,
+};
+static struct Work key_work = INIT_WORK(process_keys);
 
-static void write_key_buffer(char ch)
+static void write_key_buffer(struct KeyBuffer* kb, char ch)
 {
-    int next_write_pos = (key_buf.end + 1) % MAX_KEY_BUF_SIZE;
+    int next_write_pos = (kb->end + 1) % MAX_KEY_BUF_SIZE;
 
     /* Check if the buffer is full */
-    if (next_write_pos == key_buf.front)
+    if (next_write_pos == kb->front)
         return;
 
-    key_buf.buf[key_buf.end] = ch;
-    key_buf.end = next_write_pos;
+    kb->buf[kb->end] = ch;
+    kb->end = next_write_pos;
 }
 
 char read_key_buffer(void)
@@ -51,38 +61,59 @@ char read_key_buffer(void)
     return ch;
 }
 
-void capture_key(void)
+static void handle_key(char key)
 {
     /* stdin should only work for current foreground process */
     struct Process* fg_proc = get_fg_process();
     if (fg_proc == NULL)
         return;
-    /* Capture the pressed key from uart module and check for special characters */
-    char key = read_char();
+    /* Flush to stdout if foreground process not using key input to prevent residual characters in key buffer */
+    if (fg_proc->event != KEYBOARD_INPUT){
+        if (key == '\r')
+            key = '\n';
+        write_char(key);
+        return;
+    }
+    /* Push the key to circular buffer */
+    write_key_buffer(&key_buf, key);
+}
+
+/* Bottom half of the UART interrupt run on a worker thread. Echoing the keys and buffering them for the reader are kept out of the handler */
+static void process_keys(struct Work* work)
+{
+    char key;
+
+    while (rx_buf.front != rx_buf.end)
+    {
+        key = rx_buf.buf[rx_buf.front];
+        rx_buf.front = (rx_buf.front + 1) % MAX_KEY_BUF_SIZE;
+        handle_key(key);
+    }
+    wake_up(KEYBOARD_INPUT);
+}
+
+/* Act on a key received by the UART interrupt handler. Job control keys signal the foreground process right away, so that it
+   can be interrupted even if it keeps the worker thread off the processor. Other keys are stashed for the bottom half */
+void capture_key(char key)
+{
+    struct Process* fg_proc;
+
     switch (key)
     {
     case ASCII_CTRL_C:
-        kill(get_process(fg_proc->ppid), fg_proc->pid, SIGINT);
-        break;
     case ASCII_CTRL_Z:
-        kill(get_process(fg_proc->ppid), fg_proc->pid, SIGTSTP);
+        fg_proc = get_fg_process();
+        if (fg_proc != NULL)
+            kill(get_process(fg_proc->ppid), fg_proc->pid, key == ASCII_CTRL_C ? SIGINT : SIGTSTP);
         break;
     default:
-        /* Flush to stdout if foreground process not using key input to prevent residual characters in key buffer */
-        if (fg_proc->event != KEYBOARD_INPUT){
-            if (key == '\r')
-                key = '\n';
-            write_char(key);
-            return;
-        }
+        write_key_buffer(&rx_buf, key);
         break;
     }
-    /* Push the key to circular buffer */
-    if (fg_proc->event == KEYBOARD_INPUT)
-        write_key_buffer(key);
 }
 
+/* Have the bottom half act on the captured keys */
 void notify_process(void)
 {
-    wake_up(KEYBOARD_INPUT);
+    schedule_work(&key_work);
 }
@@ -35,7 +35,7 @@ struct KeyBuffer
 #define ASCII_CTRL_Z 26
 
 char read_key_buffer(void);
-void capture_key(void);
+void capture_key(char key);
 void notify_process(void);
 
 #endif
\ No newline at end of file
@@ -52,8 +52,9 @@ void uart_handler(void)
         /* Read all characters in the FIFO buffer until the RXFE (Receive FIFO empty) bit of flags register is set */
         while (!(in_word(UART0_FR) & (1 << 4)))
         {
-            capture_key();
+            capture_key(read_char());
         }
+        /* The keys are acted on by the bottom half on a worker thread */
         notify_process();
         /* Clear the interrupt by setting bit 4 of the interrupt clear register */
         out_word(UART0_ICR, (1 << 4));
@@ -87,12 +87,17 @@
 .global vector_table
 .global enable_timer
 .global read_timer_freq
+.global read_counter
 .global read_timer_status
+.global read_far
 .global set_timer_interval
+.global set_timer_deadline
 .global enable_irq
+.global disable_irq
 .global pstart
 .global swap
 .global trap_return
+.global kthread_start
 
 # Align the vector table to a 2KB boundary (0x800 = 2048)
 # Align each handler within it to 128 byte boundary (0x80 = 128)
@@ -135,7 +140,11 @@ current_el_spn_serror:
 # Lower el with aarch64 handlers for EL0. These are the ones we'll use for EL0 exceptions
 .balign 0x80
 lower_el_aarch64_sync:
+#ifdef FAST_SYSCALL
+    b el0_sync_handler
+#else
     b sync_handler
+#endif
 
 .balign 0x80
 lower_el_aarch64_irq:
@@ -167,6 +176,9 @@ lower_el_aarch32_serror:
     b error
 
 trap_return:
+    # Drop the kernel lock taken by the handler (or carried over by the context switch which got a new process here)
+    # The registers clobbered by the call are restored from the context frame below
+    bl unlock_kernel
     # Restore GPRs and other registers of previous context with the load pair instruction
     # NOTE We don't need to restore trap number and error code from the stack anywhere
     # However, the return address and pstate values need to restored in respective registers
@@ -176,6 +188,16 @@ trap_return:
 
     kernel_exit
 
+kthread_start:
+    # First run of a kernel thread. Like trap_return, drop the kernel lock carried over by the context switch
+    # The thread runs with interrupts enabled and is preempted through the EL1 interrupt vector like a user process
+    bl unlock_kernel
+    bl enable_irq
+    # Call the thread function saved in x19 with the argument saved in x20. Its return value is the exit status of the thread
+    mov x0, x20
+    blr x19
+    bl kthread_exit
+
 sync_handler:
     kernel_entry
     # Read the exception syndrome register to get the exception class
@@ -187,11 +209,70 @@ sync_handler:
     # Conditional select of value in x1 (Exception ID 1 for sync exceptions) or x3 (Exception ID 3 for system call trap) 
     mov x1, #1
     mov x3, #3
-    # Copy x2 in x0 if comparison above is not equal, otherwise copy x3
-    csel x0, x2, x3, ne
+    # Copy x1 in x0 if comparison above is not equal, otherwise copy x3
+    csel x0, x1, x3, ne
     handler_entry
     b trap_return
 
+#ifdef FAST_SYSCALL
+el0_sync_handler:
+    # System calls flagged in the fast syscall map neither sleep nor reschedule, hence they skip the full context frame
+    # Only the registers a call may clobber (x0-x18, x30) and the exception return registers are saved, in 22 slots
+    sub sp, sp, #(22*8)
+    stp x0, x1, [sp]
+    # Bits 26-31 in esr contain the exception class. Anything but a system call (0x15) takes the regular path
+    mrs x0, esr_el1
+    lsr x0, x0, #26
+    cmp x0, #0b010101
+    b.ne el0_slow_path
+    # The syscall index in x8 has to be flagged in the 64-bit map. Larger (or negative) indexes take the regular path
+    cmp x8, #63
+    b.hi el0_slow_path
+    ldr x0, =fast_syscall_map
+    ldr x0, [x0]
+    lsr x0, x0, x8
+    tbz x0, #0, el0_slow_path
+    stp x2, x3, [sp, #(16*1)]
+    stp x4, x5, [sp, #(16*2)]
+    stp x6, x7, [sp, #(16*3)]
+    stp x8, x9, [sp, #(16*4)]
+    stp x10, x11, [sp, #(16*5)]
+    stp x12, x13, [sp, #(16*6)]
+    stp x14, x15, [sp, #(16*7)]
+    stp x16, x17, [sp, #(16*8)]
+    stp x18, x30, [sp, #(16*9)]
+    # A page fault taken on a user buffer during the call overwrites the exception return registers, hence save them as well
+    mrs x0, elr_el1
+    mrs x1, spsr_el1
+    stp x0, x1, [sp, #(16*10)]
+    # Call fast_system_call(index, argc, argv) with the argument count and pointer the caller left in x0 and x1
+    mov x0, x8
+    ldp x1, x2, [sp]
+    bl fast_system_call
+    # The return value stays in x0, all the other saved registers are restored
+    ldp x1, x2, [sp, #(16*10)]
+    msr elr_el1, x1
+    msr spsr_el1, x2
+    ldr x1, [sp, #8]
+    ldp x2, x3, [sp, #(16*1)]
+    ldp x4, x5, [sp, #(16*2)]
+    ldp x6, x7, [sp, #(16*3)]
+    ldp x8, x9, [sp, #(16*4)]
+    ldp x10, x11, [sp, #(16*5)]
+    ldp x12, x13, [sp, #(16*6)]
+    ldp x14, x15, [sp, #(16*7)]
+    ldp x16, x17, [sp, #(16*8)]
+    ldp x18, x30, [sp, #(16*9)]
+    add sp, sp, #(22*8)
+    eret
+
+el0_slow_path:
+    # Undo the scratch save and build the full context frame
+    ldp x0, x1, [sp]
+    add sp, sp, #(22*8)
+    b sync_handler
+#endif
+
 irq_handler:
     kernel_entry
     # Exception ID 2 means hardware (asynchronous exception) interrupt
@@ -211,11 +292,24 @@ read_timer_freq:
     mrs x0, CNTFRQ_EL0
     ret
 
+read_counter:
+    # Read the physical count of the system counter which runs at the frequency reported by CNTFRQ_EL0
+    # The isb keeps the read from being performed ahead of the preceding instructions
+    isb
+    mrs x0, CNTPCT_EL0
+    ret
+
 set_timer_interval:
     # Load TVAL (timer value register) with value in x0
     msr CNTP_TVAL_EL0, x0
     ret
 
+set_timer_deadline:
+    # Load CVAL (comparator value register) with the absolute system count in x0 at which the timer interrupt is raised
+    # Unlike TVAL it is 64 bits wide, so that a count which is never reached leaves the timer quiet
+    msr CNTP_CVAL_EL0, x0
+    ret
+
 enable_timer:
     # Save the frame pointer (x29) and return address (x30) on the stack because we have nested function calls
     # Push x29 and x30 on the stack using the store pair instruction
@@ -246,12 +340,22 @@ read_timer_status:
     mrs x0, CNTP_CTL_EL0
     ret
 
+read_far:
+    # The fault address register holds the virtual address which caused the last instruction or data abort
+    mrs x0, far_el1
+    ret
+
 enable_irq:
     # In the pstate register, of the DAIF bits, the interrupt bit needs to cleared otherwise they will be masked
     # Write the corresponding bit (bit 2) in the daif clear register
     msr daifclr, #2
     ret
 
+disable_irq:
+    # Mask interrupts by setting the interrupt bit (bit 2) through the daif set register
+    msr daifset, #2
+    ret
+
 swap:
     # Make room for 12 GPRs on the stack. Other GPRs are saved registers hence needn't be pushed to the stack during a context switch
     sub sp, sp, #(12*8)
@@ -273,9 +377,9 @@ swap:
     # Restore the context of the new process to respective registers, which it had pushed to the stack when previously yielded
     ldp x19, x20, [sp, #(16*0)]
     ldp x21, x22, [sp, #(16*1)]
-    ldp x22, x24, [sp, #(16*2)]
-    ldp x23, x26, [sp, #(16*3)]
-    ldp x25, x28, [sp, #(16*4)]
+    ldp x23, x24, [sp, #(16*2)]
+    ldp x25, x26, [sp, #(16*3)]
+    ldp x27, x28, [sp, #(16*4)]
     ldp x29, x30, [sp, #(16*5)]
 
     # Reclaim used space on the stack
@@ -23,15 +23,28 @@
 #include <io/uart.h>
 #include <irq/syscall.h>
 #include <process/process.h>
+#include <memory/memory.h>
+#include <kernel.h>
 #include "handler.h"
 
 void enable_timer(void);
 uint32_t read_timer_status(void);
-void set_timer_interval(uint32_t value);
-uint32_t read_timer_freq(void);
+void set_timer_deadline(uint64_t count);
+uint64_t read_far(void);
 
 static uint32_t timer_interval = 0;
+/* Big kernel lock. Kernel code runs on one core at a time while user code runs on all of them. It is owned by a core rather than
+   a process, hence a context switch inside the kernel carries it over to the next process which drops it on its way out */
+#if NCPU > 1
+static struct Spinlock kernel_lock = {0};
+#endif
+static volatile int kernel_lock_owner = -1;
+static uint32_t kernel_lock_depth = 0;
+#ifdef RPI4
 static uint64_t ticks = 0;
+#else
+static uint64_t tick_base = 0; /* System count at tick 0. Ticks are derived from the counter since the timer also fires for sleepers */
+#endif
 
 void init_interrupt_controller(void)
 {
@@ -80,7 +93,97 @@ void init_interrupt_controller(void)
 /* Tick interval = 10 ms */
 uint64_t get_ticks(void)
 {
+#ifdef RPI4
     return ticks;
+#else
+    return (read_counter() - tick_base) / timer_interval;
+#endif
+}
+
+/* Nanoseconds elapsed over a number of system counts. The count is split at whole seconds to keep the products within 64 bits */
+uint64_t count_to_ns(uint64_t count)
+{
+    uint64_t freq = read_timer_freq();
+
+    return (count / freq) * NSEC_PER_SEC + ((count % freq) * NSEC_PER_SEC) / freq;
+}
+
+/* System counts spanning a number of nanoseconds, rounded up so that a deadline derived from it is never early */
+uint64_t ns_to_count(uint64_t ns)
+{
+    uint64_t freq = read_timer_freq();
+
+    return (ns / NSEC_PER_SEC) * freq + ((ns % NSEC_PER_SEC) * freq + NSEC_PER_SEC - 1) / NSEC_PER_SEC;
+}
+
+#ifndef RPI4
+/* Arm the timer of this core one-shot for the nearest of the next tick (the nearest scheduler deadline in the dynamic tick mode)
+   and, on core 0, the earliest sleeper expiry. Sleepers are thus woken when they are due rather than at the tick following it
+   Without any deadline, the comparator is set out of reach and the timer stays quiet until something else needs it */
+void program_timer(void)
+{
+    uint64_t now = get_ticks();
+#ifdef TICKLESS
+    uint64_t deadline = next_deadline(now);
+#else
+    uint64_t deadline = now + 1;
+#endif
+    uint64_t count = (deadline == UINT64_MAX) ? UINT64_MAX : tick_base + deadline * timer_interval;
+    uint64_t wake_time = (cpu_id() == 0) ? next_wake_time() : UINT64_MAX;
+
+    set_timer_deadline(wake_time < count ? wake_time : count);
+}
+#endif
+
+/* Take the kernel lock with interrupts masked. A core may take it again while holding it, e.g. on a page fault taken inside a syscall
+   A single core build keeps the bookkeeping only. Masked interrupts are all the exclusion it needs */
+void lock_kernel(void)
+{
+    int cpu = cpu_id();
+
+    if (kernel_lock_owner == cpu){
+        kernel_lock_depth++;
+        return;
+    }
+#if NCPU > 1
+    spin_lock(&kernel_lock);
+#endif
+    kernel_lock_owner = cpu;
+    kernel_lock_depth = 1;
+}
+
+void unlock_kernel(void)
+{
+    if (--kernel_lock_depth != 0)
+        return;
+    kernel_lock_owner = -1;
+#if NCPU > 1
+    spin_unlock(&kernel_lock);
+#endif
+}
+
+/* Make another core run the scheduler, e.g. after a process was queued on it while it idles */
+void send_ipi(int cpu)
+{
+#ifdef RPI4
+    (void)cpu;
+#else
+    out_word(MBOX_SET(cpu), 1);
+#endif
+}
+
+/* Start the timer interrupts of the calling core. Each core has its own generic timer, routed to it by the local interrupt controller */
+void init_cpu_timer(void)
+{
+#ifndef RPI4
+    uint32_t cpu = cpu_id();
+
+    enable_timer();
+    /* Set bit 1 (IRQ enable) of the core timer control register to enable timer interrupts */
+    out_word(CNTP_EL0(cpu), (1 << 1));
+    /* Set bit 0 of the mailbox control register to take an interrupt when mailbox 0 is written by another core */
+    out_word(MBOX_CTL(cpu), 1);
+#endif
 }
 
 void init_timer(void)
@@ -97,9 +200,8 @@ void init_timer(void)
 #else
     /* Save the timer interval for the handler to retrigger when the interrupt is triggered for the first time */
     timer_interval = read_timer_freq() / 100;
-    enable_timer();
-    /* Set bit 1 (IRQ enable) of the core timer status register to enable timer interrupts */
-    out_word(CNTP_EL0, (1 << 1));
+    tick_base = read_counter();
+    init_cpu_timer();
 #endif
 }
 
@@ -114,17 +216,19 @@ static void timer_interrupt_handler(void)
     /* If bit 0 of mask register is set, timer interrupt is asserted */
     if (status & 1)
 #else
-    /* If bit 2 is set, it means the timer has fired. Reset the timer with the same interval */
+    /* If bit 2 is set, it means the timer has fired. It is rearmed for the next deadline on the way out of the handler */
     if (status & (1 << 2))
 #endif
     {
+#ifdef RPI4
         ticks++;
-        wake_up(SLEEP_SYSCALL);
+#endif
+        /* Sleepers are looked after by core 0 alone, the other cores only program their timers for their own time slices */
+        if (cpu_id() == 0)
+            wake_sleepers(read_counter());
 #ifdef RPI4
         /* Acknowledge the interrupt by clearing the pending bit of the timer ack register */
         out_word(TIMER_ACK, 1);
-#else
-        set_timer_interval(timer_interval);
 #endif
     }
 }
@@ -146,7 +250,13 @@ void handler(struct ContextFrame* ctx)
     uint32_t irq;
     /* Whether the exception occured because of a userspace process */
     bool user_except = ((ctx->spsr & PSTATE_MODE_MASK) == 0);
-    struct Process* curr_proc = get_curr_process();
+    struct Process* curr_proc;
+
+    /* The lock is dropped in trap_return on the way out of the exception */
+    lock_kernel();
+    curr_proc = get_curr_process();
+    /* The time up to here was spent in the mode the exception was taken from */
+    account_time(user_except);
 
     /* Save register context for idle process from the kernel stack */
     if (curr_proc->pid == 0)
@@ -155,6 +265,9 @@ void handler(struct ContextFrame* ctx)
     switch (ctx->trapno)
     {
     case 1:
+        /* User pages are backed on first access and copied on first write after a fork. Retry the faulting instruction if the page fault could be serviced */
+        if (handle_page_fault(ctx->esr, read_far()))
+            break;
         if (user_except){
             printk("%x: Process (PID %d) resulted in a synchronous exception. Terminating\n", ctx->elr, curr_proc->pid);
             /* Although this exit call occurs in kernel space, it is meant to terminate the current user process which caused this exception */
@@ -171,8 +284,8 @@ void handler(struct ContextFrame* ctx)
         irq = get_irq_number();
         if (irq == TIMER_IRQ)
 #else
-        /* Read the interrupt source register to check what kind of hardware interrupt it is */
-        irq = in_word(CNTP_STATUS_EL0);
+        /* Read the interrupt source register of this core to check what kind of hardware interrupt it is */
+        irq = in_word(CNTP_STATUS_EL0(cpu_id()));
         /* High bit 1 indicates timer interrupt */
         if (irq & (1 << 1))
 #endif
@@ -180,6 +293,13 @@ void handler(struct ContextFrame* ctx)
             timer_interrupt_handler();
             schedule = true;
         }
+#ifndef RPI4
+        /* Bit 4 indicates a write to mailbox 0, which other cores use to have this one reschedule */
+        else if (irq & (1 << 4)){
+            out_word(MBOX_CLR(cpu_id()), 0xffffffff);
+            schedule = true;
+        }
+#endif
         else{
 #ifdef RPI4
             if (irq == (VC_IRQ_BASE + UART_IRQ))
@@ -215,6 +335,15 @@ void handler(struct ContextFrame* ctx)
         break;
     }
 
-    if (schedule)
+    /* Besides the timer, any exception which woke up a process outranking the running one, e.g. a real-time process waiting
+       on input, switches to it right away. That is only done on the way back to userspace or to the idle loop. A fault nested in
+       a system call, say on a user page the kernel writes to, must not switch in the middle of code which assumes it is not preempted */
+    if (schedule || ((user_except || curr_proc->pid == 0) && need_resched()))
         trigger_scheduler();
+#ifndef RPI4
+    /* Any exception may have changed the deadlines, e.g. a process woken up by input or created by a fork */
+    program_timer();
+#endif
+    /* Charge the handler to the process returning from it, which is not the one that entered if the scheduler switched */
+    account_time(false);
 }
\ No newline at end of file
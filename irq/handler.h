@@ -62,10 +62,30 @@ struct ContextFrame
 };
 
 #define PSTATE_MODE_MASK 0xF /* The mode field bitmask (EL0, EL1 etc.) of pstate register */
+#define NSEC_PER_SEC 1000000000UL
+#define CLOCK_MONOTONIC 1 /* Time since the system counter started. This is the only supported clock */
+
+struct TimeSpec
+{
+    int64_t tv_sec;
+    int64_t tv_nsec;
+};
 
 void init_timer(void);
+void init_cpu_timer(void);
+void lock_kernel(void);
+void unlock_kernel(void);
+void send_ipi(int cpu);
 void enable_irq(void);
+void disable_irq(void);
 void init_interrupt_controller(void);
 uint64_t get_ticks(void);
+uint64_t read_counter(void);
+uint32_t read_timer_freq(void);
+uint64_t count_to_ns(uint64_t count);
+uint64_t ns_to_count(uint64_t ns);
+#ifndef RPI4
+void program_timer(void);
+#endif
 
 #endif
\ No newline at end of file
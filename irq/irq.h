@@ -64,8 +64,12 @@
 #define TIMER_MSKIRQ        (BASE_ADDR + 0xB414)    /* Timer mask register */
 #define TIMER_PREDIV        (BASE_ADDR + 0xB41c)    /* Timer pre-divider register */
 #else
-#define CNTP_EL0        TO_VIRT(0x40000040) /* Core 0 interrupt timer control register */ 
-#define CNTP_STATUS_EL0 TO_VIRT(0x40000060) /* Core 0 interrupt source register */
+/* The local interrupt controller has a set of registers per core, 4 bytes (16 for the mailboxes) apart */
+#define CNTP_EL0(core)          TO_VIRT(0x40000040 + (core)*4)  /* Core timer interrupt control register */
+#define MBOX_CTL(core)          TO_VIRT(0x40000050 + (core)*4)  /* Core mailbox interrupt control register */
+#define CNTP_STATUS_EL0(core)   TO_VIRT(0x40000060 + (core)*4)  /* Core interrupt source register */
+#define MBOX_SET(core)          TO_VIRT(0x40000080 + (core)*16) /* Core mailbox 0 write-set register */
+#define MBOX_CLR(core)          TO_VIRT(0x400000c0 + (core)*16) /* Core mailbox 0 read/write-clear register */
 #endif
 
 #endif
\ No newline at end of file
@@ -24,6 +24,7 @@
 #include <stddef.h>
 #include <process/process.h>
 #include <fs/file.h>
+#include <memory/memory.h>
 
 static SYSTEMCALL syscall_list[TOTAL_SYSCALL_FUNCTIONS];
 
@@ -35,19 +36,18 @@ static int64_t sys_write(int64_t *argv)
     return (int)argv[1];
 }
 
-static int64_t sys_sleep(int64_t* argv)
+/* Sleep until the system counter reaches the wake time. Loop in case the process is woken up early, say by a signal */
+static void sleep_until(uint64_t wake_time)
 {
-    uint64_t ticks = get_ticks();
-    uint64_t sleep_ticks = argv[0];
-
-    uint64_t target_ticks = ticks + sleep_ticks;
-
-    /* Put the process to sleep at every tick until the sleep duration has elapsed */
-    while (ticks < target_ticks)
-    {
+    get_curr_process()->wake_time = wake_time;
+    while (read_counter() < wake_time)
         sleep(SLEEP_SYSCALL);
-        ticks = get_ticks();
-    }
+}
+
+static int64_t sys_sleep(int64_t* argv)
+{
+    /* The duration is given in 10 ms ticks */
+    sleep_until(read_counter() + ns_to_count((uint64_t)argv[0] * (NSEC_PER_SEC / 100)));
 
     return 0;
 }
@@ -94,6 +94,16 @@ static int64_t sys_exec(int64_t* argv)
     return exec(get_curr_process(), (char*)argv[0], (const char**)argv[1]);
 }
 
+static int64_t sys_vfork(int64_t* argv)
+{
+    return vfork();
+}
+
+static int64_t sys_spawn(int64_t* argv)
+{
+    return spawn((const char*)argv[0], (const char**)argv[1], (const char**)argv[2]);
+}
+
 static int64_t sys_keyboard_read(int64_t* argv)
 {
     struct Process* curr_process = get_curr_process();
@@ -243,6 +253,87 @@ static int64_t sys_switchpenv(int64_t* argv)
     return 0;
 }
 
+static int64_t sys_brk(int64_t* argv)
+{
+    return set_brk(get_curr_process(), argv[0]);
+}
+
+static int64_t sys_mmap(int64_t* argv)
+{
+    return map_file(get_curr_process(), argv[0], argv[1], argv[2]);
+}
+
+static int64_t sys_munmap(int64_t* argv)
+{
+    return unmap_file(get_curr_process(), argv[0], argv[1]);
+}
+
+static int64_t sys_clock_gettime(int64_t* argv)
+{
+    struct TimeSpec* ts = (struct TimeSpec*)argv[1];
+    uint64_t ns;
+
+    if (argv[0] != CLOCK_MONOTONIC || ts == NULL)
+        return -1;
+    ns = count_to_ns(read_counter());
+    ts->tv_sec = ns / NSEC_PER_SEC;
+    ts->tv_nsec = ns % NSEC_PER_SEC;
+
+    return 0;
+}
+
+static int64_t sys_nanosleep(int64_t* argv)
+{
+    const struct TimeSpec* req = (const struct TimeSpec*)argv[0];
+    struct TimeSpec* rem = (struct TimeSpec*)argv[1];
+    uint64_t wake_time;
+    uint64_t freq = read_timer_freq();
+
+    if (req == NULL || req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= NSEC_PER_SEC)
+        return -1;
+    wake_time = read_counter() + ns_to_count(req->tv_nsec);
+    /* A wake time past the range of the counter saturates, which leaves the process asleep until it is signalled */
+    if ((uint64_t)req->tv_sec > (UINT64_MAX - wake_time) / freq)
+        wake_time = UINT64_MAX;
+    else
+        wake_time += req->tv_sec * freq;
+    sleep_until(wake_time);
+    /* The sleep is always carried out in full */
+    if (rem != NULL)
+        rem->tv_sec = rem->tv_nsec = 0;
+
+    return 0;
+}
+
+static int64_t sys_proc_stat(int64_t* argv)
+{
+    return get_proc_stat(argv[0], (struct ProcStat*)argv[1]);
+}
+
+static int64_t sys_system_stat(int64_t* argv)
+{
+    if ((struct SysStat*)argv[0] == NULL)
+        return -1;
+    get_sys_stat((struct SysStat*)argv[0]);
+
+    return 0;
+}
+
+static int64_t sys_setpriority(int64_t* argv)
+{
+    return set_nice(argv[0], argv[1]);
+}
+
+static int64_t sys_sched_setscheduler(int64_t* argv)
+{
+    return set_scheduler(argv[0], argv[1], argv[2]);
+}
+
+static int64_t sys_sched_getscheduler(int64_t* argv)
+{
+    return get_scheduler(argv[0]);
+}
+
 static void sigproxy_restore(struct ContextFrame *ctx)
 {
     struct Process* process = get_curr_process();
@@ -286,7 +377,42 @@ void init_system_call(void)
     syscall_list[23] = sys_unsetenv;
     syscall_list[24] = sys_getfullenv;
     syscall_list[25] = sys_switchpenv;
+    syscall_list[26] = sys_brk;
+    syscall_list[27] = sys_mmap;
+    syscall_list[28] = sys_munmap;
+    syscall_list[29] = sys_clock_gettime;
+    syscall_list[30] = sys_nanosleep;
+    syscall_list[31] = sys_proc_stat;
+    syscall_list[32] = sys_system_stat;
+    syscall_list[33] = sys_setpriority;
+    syscall_list[34] = sys_sched_setscheduler;
+    syscall_list[35] = sys_sched_getscheduler;
+    syscall_list[36] = sys_vfork;
+    syscall_list[37] = sys_spawn;
+}
+
+#ifdef FAST_SYSCALL
+/* Syscalls served by the fast path of the exception vector, bit n standing for index n. They must neither sleep nor reschedule
+   nor touch the register context, since only the registers a call may clobber are saved for them: get_pid, get_jpid, get_ppid,
+   getenv, clock_gettime, get_proc_stat, get_sys_stat and sched_getscheduler */
+const uint64_t fast_syscall_map = (1UL << 11) | (1UL << 13) | (1UL << 20) | (1UL << 22) | (1UL << 29) | (1UL << 31) | (1UL << 32) | (1UL << 35);
+
+/* Entry of the syscall fast path. The index is known to be flagged in the fast syscall map, hence valid
+   @return the value handed back to the caller in x0 */
+int64_t fast_system_call(int64_t index, int64_t argc, int64_t* argv)
+{
+    int64_t ret = -1;
+
+    lock_kernel();
+    account_time(true);
+    if (argc >= 0)
+        ret = syscall_list[index](argv);
+    account_time(false);
+    unlock_kernel();
+
+    return ret;
 }
+#endif
 
 void system_call(struct ContextFrame *ctx)
 {
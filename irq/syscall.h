@@ -24,8 +24,11 @@
 typedef int64_t (*SYSTEMCALL)(int64_t *argv);
 void init_system_call(void);
 void system_call(struct ContextFrame* ctx);
+#ifdef FAST_SYSCALL
+int64_t fast_system_call(int64_t index, int64_t argc, int64_t* argv);
+#endif
 
-#define TOTAL_SYSCALL_FUNCTIONS 26
+#define TOTAL_SYSCALL_FUNCTIONS 38
 
 /* Special request codes. DO NOT map these to regular syscall numbers */
 #define SIG_PROXY_REQUEST       101
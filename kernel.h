@@ -31,4 +31,13 @@
 #define container_of(ptr, type, member) \
                 ((type *) ((char *)(ptr) - offsetof(type, member)))
 
+/* Number of processor cores brought up. The secondary cores are only released in an SMP build (see the SMP make variable), since
+   the exclusive accesses of the kernel lock need the data cache, which is not enabled yet, on real hardware
+   The Raspberry Pi 4 build lacks the per core interrupt routing and runs on core 0 only */
+#if defined(SMP) && !defined(RPI4)
+#define NCPU 4
+#else
+#define NCPU 1
+#endif
+
 #endif
\ No newline at end of file
@@ -22,63 +22,64 @@
 #include <io/print.h>
 #include <memory/memory.h>
 
-void push_back(struct List *list, struct Node *node)
+/* Detach a node from the list it is known to be linked on */
+static void unlink_node(struct List* list, struct Node* node)
 {
-    if (list->head == NULL){
-        list->head = list->tail = node;
-        node->next = NULL;
-        return;
-    }
+    if (node->prev != NULL)
+        node->prev->next = node->next;
+    else
+        list->head = node->next;
+    if (node->next != NULL)
+        node->next->prev = node->prev;
+    else
+        list->tail = node->prev;
+    node->next = node->prev = NULL;
+    node->list = NULL;
+}
 
-    list->tail->next = node;
+void push_back(struct List *list, struct Node *node)
+{
     node->next = NULL;
+    node->prev = list->tail;
+    node->list = list;
+    if (list->head == NULL)
+        list->head = node;
+    else
+        list->tail->next = node;
     list->tail = node;
 }
 
+void push_front(struct List *list, struct Node *node)
+{
+    node->prev = NULL;
+    node->next = list->head;
+    node->list = list;
+    if (list->tail == NULL)
+        list->tail = node;
+    else
+        list->head->prev = node;
+    list->head = node;
+}
+
 struct Node *pop_front(struct List *list)
 {
-    struct Node* node = NULL;
-
-    if (list->head != NULL){
-        node = list->head;
-        if (list->tail == node)
-            list->head = list->tail = NULL;
-        else
-            list->head = node->next;
-    }
+    struct Node* node = list->head;
+
+    if (node != NULL)
+        unlink_node(list, node);
 
     return node;
 }
 
+/* Unlink a node in constant time
+   @return the node if it was linked on the given list, NULL otherwise */
 struct Node *remove(struct List *list, const struct Node *node)
 {
-    struct Node* curr_node = list->head;
-    struct Node* prev = NULL;
+    if (node == NULL || node->list != list)
+        return NULL;
+    unlink_node(list, (struct Node*)node);
 
-    while (curr_node != NULL)
-    {
-        if (node == curr_node){
-            if (prev == NULL){
-                if (list->tail == curr_node)
-                    list->head = list->tail = NULL;
-                else
-                    list->head = curr_node->next;
-            }
-            else{
-                if (list->tail == curr_node){
-                    list->tail = prev;
-                    prev->next = NULL;
-                }
-                else
-                    prev->next = curr_node->next;
-            }
-            break;
-        }
-        prev = curr_node;
-        curr_node = curr_node->next;
-    }
-    
-    return curr_node;
+    return (struct Node*)node;
 }
 
 struct Node* front(const struct List* list)
@@ -93,43 +94,19 @@ struct Node *back(const struct List *list)
 
 bool contains(const struct List *list, const struct Node *node)
 {
-    const struct Node* curr_node = list->head;
-
-    while (curr_node != NULL)
-    {
-        if (node == curr_node)
-            return true;
-        curr_node = curr_node->next;
-    }
-    
-    return false;
+    return node != NULL && node->list == list;
 }
 
 struct Node *remove_evt(struct List* list, struct Node** const from, int event)
 {
     struct Node* node = from && *from ? *from : list->head;
-    struct Node* prev = NULL;
-    
-    while (node != NULL)
-    {
-        if (((struct Process*)node)->event == event){
-            if (list->head == node){
-                list->head = node->next;
-                node->next = NULL;
-            }
-            else{
-                prev->next = node->next;
-                node->next = NULL;
-                if (list->tail == node)
-                    list->tail = prev;
-            }
-            break;
-        }
-        prev = node;
+
+    while (node != NULL && ((struct Process*)node)->event != event)
         node = node->next;
-    }
     if (from != NULL)
         *from = node ? node->next : NULL;
+    if (node != NULL)
+        unlink_node(list, node);
     
     return node;
 }
@@ -263,6 +240,269 @@ void print_list(const struct List* list, const char* name)
 }
 #endif
 
+static void rb_rotate_left(struct RbTree* tree, struct RbNode* node)
+{
+    struct RbNode* pivot = node->right;
+
+    node->right = pivot->left;
+    if (pivot->left != NULL)
+        pivot->left->parent = node;
+    pivot->parent = node->parent;
+    if (node->parent == NULL)
+        tree->root = pivot;
+    else if (node == node->parent->left)
+        node->parent->left = pivot;
+    else
+        node->parent->right = pivot;
+    pivot->left = node;
+    node->parent = pivot;
+}
+
+static void rb_rotate_right(struct RbTree* tree, struct RbNode* node)
+{
+    struct RbNode* pivot = node->left;
+
+    node->left = pivot->right;
+    if (pivot->right != NULL)
+        pivot->right->parent = node;
+    pivot->parent = node->parent;
+    if (node->parent == NULL)
+        tree->root = pivot;
+    else if (node == node->parent->right)
+        node->parent->right = pivot;
+    else
+        node->parent->left = pivot;
+    pivot->right = node;
+    node->parent = pivot;
+}
+
+static bool rb_is_red(const struct RbNode* node)
+{
+    return node != NULL && node->red;
+}
+
+/* Link a node in order and restore the red-black properties. The tree height stays logarithmic in the number of nodes */
+void rb_insert(struct RbTree* tree, struct RbNode* node, RB_LESS less)
+{
+    struct RbNode** link = &tree->root;
+    struct RbNode* parent = NULL;
+    struct RbNode* gparent;
+    struct RbNode* uncle;
+    bool leftmost = true;
+
+    while (*link != NULL)
+    {
+        parent = *link;
+        if (less(node, parent))
+            link = &parent->left;
+        else{
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+    node->parent = parent;
+    node->left = node->right = NULL;
+    node->red = true;
+    node->tree = tree;
+    *link = node;
+    if (leftmost)
+        tree->leftmost = node;
+
+    while (rb_is_red(parent = node->parent))
+    {
+        gparent = parent->parent;
+        if (parent == gparent->left){
+            uncle = gparent->right;
+            if (rb_is_red(uncle)){
+                parent->red = uncle->red = false;
+                gparent->red = true;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->right){
+                rb_rotate_left(tree, parent);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->red = false;
+            gparent->red = true;
+            rb_rotate_right(tree, gparent);
+        }
+        else{
+            uncle = gparent->left;
+            if (rb_is_red(uncle)){
+                parent->red = uncle->red = false;
+                gparent->red = true;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->left){
+                rb_rotate_right(tree, parent);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->red = false;
+            gparent->red = true;
+            rb_rotate_left(tree, gparent);
+        }
+    }
+    tree->root->red = false;
+}
+
+/* Put a subtree in the place of a node in the eyes of the node's parent */
+static void rb_replace(struct RbTree* tree, struct RbNode* node, struct RbNode* subtree)
+{
+    if (node->parent == NULL)
+        tree->root = subtree;
+    else if (node == node->parent->left)
+        node->parent->left = subtree;
+    else
+        node->parent->right = subtree;
+    if (subtree != NULL)
+        subtree->parent = node->parent;
+}
+
+/* Rebalance after a black node was taken out above the given position, which is short of one black node on its paths */
+static void rb_erase_fixup(struct RbTree* tree, struct RbNode* node, struct RbNode* parent)
+{
+    struct RbNode* sibling;
+
+    while (node != tree->root && !rb_is_red(node))
+    {
+        if (node == parent->left){
+            sibling = parent->right;
+            if (sibling->red){
+                sibling->red = false;
+                parent->red = true;
+                rb_rotate_left(tree, parent);
+                sibling = parent->right;
+            }
+            if (!rb_is_red(sibling->left) && !rb_is_red(sibling->right)){
+                sibling->red = true;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (!rb_is_red(sibling->right)){
+                sibling->left->red = false;
+                sibling->red = true;
+                rb_rotate_right(tree, sibling);
+                sibling = parent->right;
+            }
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->right->red = false;
+            rb_rotate_left(tree, parent);
+        }
+        else{
+            sibling = parent->left;
+            if (sibling->red){
+                sibling->red = false;
+                parent->red = true;
+                rb_rotate_right(tree, parent);
+                sibling = parent->left;
+            }
+            if (!rb_is_red(sibling->left) && !rb_is_red(sibling->right)){
+                sibling->red = true;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (!rb_is_red(sibling->left)){
+                sibling->right->red = false;
+                sibling->red = true;
+                rb_rotate_left(tree, sibling);
+                sibling = parent->left;
+            }
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->left->red = false;
+            rb_rotate_right(tree, parent);
+        }
+        node = tree->root;
+    }
+    if (node != NULL)
+        node->red = false;
+}
+
+/* Unlink a node from the tree it is known to be linked in */
+void rb_erase(struct RbTree* tree, struct RbNode* node)
+{
+    struct RbNode* successor = node;
+    struct RbNode* child;
+    struct RbNode* parent;
+    bool removed_red = node->red;
+
+    if (tree->leftmost == node)
+        tree->leftmost = rb_next(node);
+    if (node->left == NULL){
+        child = node->right;
+        parent = node->parent;
+        rb_replace(tree, node, child);
+    }
+    else if (node->right == NULL){
+        child = node->left;
+        parent = node->parent;
+        rb_replace(tree, node, child);
+    }
+    else{
+        /* Move the in-order successor, which has no left child, into the place of the node */
+        successor = node->right;
+        while (successor->left != NULL)
+            successor = successor->left;
+        removed_red = successor->red;
+        child = successor->right;
+        if (successor->parent == node)
+            parent = successor;
+        else{
+            parent = successor->parent;
+            rb_replace(tree, successor, child);
+            successor->right = node->right;
+            successor->right->parent = successor;
+        }
+        rb_replace(tree, node, successor);
+        successor->left = node->left;
+        successor->left->parent = successor;
+        successor->red = node->red;
+    }
+    if (!removed_red)
+        rb_erase_fixup(tree, child, parent);
+    node->parent = node->left = node->right = NULL;
+    node->tree = NULL;
+}
+
+struct RbNode* rb_first(const struct RbTree* tree)
+{
+    return tree->leftmost;
+}
+
+struct RbNode* rb_last(const struct RbTree* tree)
+{
+    struct RbNode* node = tree->root;
+
+    while (node != NULL && node->right != NULL)
+        node = node->right;
+
+    return node;
+}
+
+/* @return the node following the given one in order, NULL if it is the last */
+struct RbNode* rb_next(const struct RbNode* node)
+{
+    const struct RbNode* parent;
+
+    if (node->right != NULL){
+        node = node->right;
+        while (node->left != NULL)
+            node = node->left;
+        return (struct RbNode*)node;
+    }
+    while ((parent = node->parent) != NULL && node == parent->right)
+        node = parent;
+
+    return (struct RbNode*)parent;
+}
+
 int strlen(const char *str)
 {
     int len = 0;
@@ -27,9 +27,14 @@
 #define MAX_VAL_LEN 128
 #define HASH_TABLE_SIZE 101
 
+struct List;
+
+/* Intrusive doubly linked list node. Structures linked on a list start with the same members in the same order */
 struct Node
 {
     struct Node* next;
+    struct Node* prev;
+    struct List* list; /* List the node is currently linked on, NULL if none */
 };
 
 struct List
@@ -38,6 +43,27 @@ struct List
     struct Node* tail;
 };
 
+struct RbTree;
+
+/* Intrusive red-black tree node. Structures kept on a tree embed one and get back to themselves with container_of (see kernel.h) */
+struct RbNode
+{
+    struct RbNode* parent;
+    struct RbNode* left;
+    struct RbNode* right;
+    struct RbTree* tree; /* Tree the node is currently linked in, NULL if none */
+    bool red;
+};
+
+struct RbTree
+{
+    struct RbNode* root;
+    struct RbNode* leftmost; /* Cached smallest node, so that the minimum is found in constant time */
+};
+
+/* Ordering of the nodes of a tree. Nodes comparing equal are kept in insertion order */
+typedef bool (*RB_LESS)(const struct RbNode* a, const struct RbNode* b);
+
 struct MapEntry
 {
     char key[MAX_KEY_LEN];
@@ -50,7 +76,17 @@ struct Map
     struct MapEntry table[HASH_TABLE_SIZE];
 };
 
+/* A lock word only ever taken with interrupts masked, since a core spinning on a lock held by its own interrupted context would never get it */
+struct Spinlock
+{
+    volatile uint32_t locked;
+};
+
 unsigned char get_el(void);
+uint32_t cpu_id(void);
+void send_event(void);
+void spin_lock(struct Spinlock* lock);
+void spin_unlock(struct Spinlock* lock);
 void delay(uint64_t value);
 void out_word(uint64_t addr, uint32_t value);
 uint32_t in_word(uint64_t addr);
@@ -61,6 +97,7 @@ void memmove(void* dst, void* src, unsigned int size);
 int memcmp(void* src1, void* src2, unsigned int size);
 
 void push_back(struct List* list, struct Node* node);
+void push_front(struct List* list, struct Node* node);
 struct Node* pop_front(struct List* list);
 struct Node* remove(struct List* list, const struct Node* node);
 struct Node* front(const struct List* list);
@@ -72,6 +109,13 @@ bool empty(const struct List* list);
 void print_list(const struct List* list, const char* name);
 #endif
 
+/* Red-black tree functions */
+void rb_insert(struct RbTree* tree, struct RbNode* node, RB_LESS less);
+void rb_erase(struct RbTree* tree, struct RbNode* node);
+struct RbNode* rb_first(const struct RbTree* tree);
+struct RbNode* rb_last(const struct RbTree* tree);
+struct RbNode* rb_next(const struct RbNode* node);
+
 /* Special functions for managing the process queues based on event occurence */
 struct Node* remove_evt(struct List* list, struct Node** const from, int event);
 struct Node* find_evt(const struct Node* head, int event);
@@ -24,6 +24,18 @@
 .global memmove
 .global memcmp
 .global get_el
+.global cpu_id
+.global send_event
+.global spin_lock
+.global spin_unlock
+#ifdef MEMBENCH
+.global memset_byte
+.global memcmp_byte
+.global memcpy_byte
+#endif
+
+# Zeroing at least this many bytes uses dc zva
+.equ ZVA_THRESHOLD, 256
 
 get_el:
     # Read the currentel system register for current exception level (ELO-EL3) and save it in x0 register
@@ -32,6 +44,39 @@ get_el:
     lsr x0, x0, #2
     ret
 
+cpu_id:
+    # The affinity level 0 field of the multiprocessor affinity register numbers the cores of the cluster
+    mrs x0, mpidr_el1
+    and x0, x0, #3
+    ret
+
+send_event:
+    # Make prior stores visible to the other cores before waking up the ones waiting in wfe
+    dsb sy
+    sev
+    ret
+
+spin_lock:
+    # x0 => address of the 32-bit lock word. Spin until it is swapped from 0 to 1 by this core
+    mov w2, #1
+    # Set the local event register so that the first wfe falls through
+    sevl
+spin_wait:
+    # Sleep until the lock word is written (the exclusive monitor is cleared) or some other event arrives
+    wfe
+    # Load-acquire exclusive keeps accesses of the critical section from being performed ahead of taking the lock
+    ldaxr w1, [x0]
+    cbnz w1, spin_wait
+    # The store fails if another core wrote the lock word since the exclusive load
+    stxr w1, w2, [x0]
+    cbnz w1, spin_wait
+    ret
+
+spin_unlock:
+    # Store-release publishes the critical section before the lock is seen free. Clearing the monitors of the waiters wakes them from wfe
+    stlr wzr, [x0]
+    ret
+
 delay:
     # First arg will be present in register x0 which will be subtracted till it becomes 0
     subs x0, x0, #1
@@ -50,24 +95,97 @@ in_word:
     ret
 
 memset:
-    # x0 => dst x1 => value x2 => size
-    cmp x2, #0
-    beq memset_end
-set:
-    # Increment x0 (address of dst) by 1 after we store 1-byte value from w1 register to x0
+    # x0 => dst w1 => value w2 => size
+    # The size is a 32-bit unsigned int. Zero extend it since the upper half of x2 is undefined
+    mov w2, w2
+    # Replicate the byte value in all 8 bytes of x1 so that it can be stored 16 bytes at a time with stp
+    and x1, x1, #0xff
+    orr x1, x1, x1, lsl #8
+    orr x1, x1, x1, lsl #16
+    orr x1, x1, x1, lsl #32
+    cmp x2, #16
+    blo set_tail
+    # Store the first 16 bytes unaligned and move dst up to the next 16 byte boundary. The bytes stored twice hold the same value
+    stp x1, x1, [x0]
+    and x3, x0, #15
+    mov x4, #16
+    sub x3, x4, x3
+    add x0, x0, x3
+    sub x2, x2, x3
+
+    # Large blocks of zeros are cleared a cache line at a time with dc zva unless the instruction is prohibited (DZP bit of dczid_el0)
+    cbnz x1, set_64
+    cmp x2, #ZVA_THRESHOLD
+    blo set_64
+    mrs x3, dczid_el0
+    tbnz w3, #4, set_64
+    # Bits [3:0] of dczid_el0 hold log2 of the zeroing block size in words
+    and w3, w3, #15
+    mov x4, #4
+    lsl x4, x4, x3
+    # Keep at least two blocks to spare so that aligning dst to the block size can not run past the end
+    cmp x2, x4, lsl #1
+    blo set_64
+    sub x5, x4, #1
+zva_align:
+    tst x0, x5
+    beq zva_check
+    stp xzr, xzr, [x0], #16
+    sub x2, x2, #16
+    b zva_align
+zva_loop:
+    dc zva, x0
+    add x0, x0, x4
+    sub x2, x2, x4
+zva_check:
+    cmp x2, x4
+    bhs zva_loop
+
+set_64:
+    # Store 64 bytes per iteration with 4 store pair instructions
+    cmp x2, #64
+    blo set_16
+    stp x1, x1, [x0]
+    stp x1, x1, [x0, #16]
+    stp x1, x1, [x0, #32]
+    stp x1, x1, [x0, #48]
+    add x0, x0, #64
+    sub x2, x2, #64
+    b set_64
+set_16:
+    cmp x2, #16
+    blo set_tail
+    stp x1, x1, [x0], #16
+    sub x2, x2, #16
+    b set_16
+set_tail:
+    # Less than 16 bytes remain which are set one at a time
+    cbz x2, memset_end
     strb w1, [x0], #1
-    # Subtract 1 from x2 and update conditional flags according to result (accomplished by suffix 's' in subs instruction)
     subs x2, x2, #1
-    bne set
+    bne set_tail
 
 memset_end:
     ret
 
 memcmp:
-    # x0 => src1 x1 => src2 x2 => size
+    # x0 => src1 x1 => src2 w2 => size
+    mov w2, w2
     mov x3, x0
     # We do this to clear the x0 register for possible return value
     mov x0, #0
+compare_16:
+    # Compare 16 bytes at a time. Unaligned loads are fine on normal memory
+    cmp x2, #16
+    blo compare
+    ldp x4, x5, [x3], #16
+    ldp x6, x7, [x1], #16
+    sub x2, x2, #16
+    cmp x4, x6
+    # If the first pair matched compare the second one, otherwise force the not equal condition
+    ccmp x5, x7, #0, eq
+    beq compare_16
+    b compare_fail
 compare:
     cmp x2, #0
     beq memcmp_end
@@ -77,6 +195,7 @@ compare:
     sub x2, x2, #1
     cmp w4, w5
     beq compare
+compare_fail:
     # Comparison failed. Return 1
     mov x0, #1
 
@@ -85,22 +204,158 @@ memcmp_end:
 
 memmove:
 memcpy:
+    # x0 => dst x1 => src w2 => size
+    mov w2, w2
+    cbz x2, memcpy_end
+    cmp x1, x0
+    # If x1 is higher or same as x0, copy forwards from the first byte
+    bhs copy_fwd
+    # x3 = base address in x1 + size
+    add x3, x1, x2
+    cmp x3, x0
+    # If x3 is higher than x0, the end of src overlaps dst and the data has to be copied backwards from the last byte
+    bhi copy_bwd
+
+copy_fwd:
+    cmp x2, #16
+    blo fwd_tail
+fwd_align:
+    # Copy single bytes until dst is 16 byte aligned. The source may stay unaligned
+    tst x0, #15
+    beq fwd_64
+    ldrb w3, [x1], #1
+    strb w3, [x0], #1
+    sub x2, x2, #1
+    b fwd_align
+fwd_64:
+    # Load all 64 bytes before storing any of them which keeps the copy correct when dst overlaps src from below
+    cmp x2, #64
+    blo fwd_16
+    ldp x3, x4, [x1]
+    ldp x5, x6, [x1, #16]
+    ldp x7, x8, [x1, #32]
+    ldp x9, x10, [x1, #48]
+    stp x3, x4, [x0]
+    stp x5, x6, [x0, #16]
+    stp x7, x8, [x0, #32]
+    stp x9, x10, [x0, #48]
+    add x1, x1, #64
+    add x0, x0, #64
+    sub x2, x2, #64
+    b fwd_64
+fwd_16:
+    cmp x2, #16
+    blo fwd_tail
+    ldp x3, x4, [x1], #16
+    stp x3, x4, [x0], #16
+    sub x2, x2, #16
+    b fwd_16
+fwd_tail:
+    cbz x2, memcpy_end
+    ldrb w3, [x1], #1
+    strb w3, [x0], #1
+    subs x2, x2, #1
+    bne fwd_tail
+    ret
+
+copy_bwd:
+    # Point src and dst past their last byte and copy downwards with pre-decrement addressing
+    add x0, x0, x2
+    add x1, x1, x2
+    cmp x2, #16
+    blo bwd_tail
+bwd_align:
+    tst x0, #15
+    beq bwd_64
+    ldrb w3, [x1, #-1]!
+    strb w3, [x0, #-1]!
+    sub x2, x2, #1
+    b bwd_align
+bwd_64:
+    cmp x2, #64
+    blo bwd_16
+    ldp x3, x4, [x1, #-16]
+    ldp x5, x6, [x1, #-32]
+    ldp x7, x8, [x1, #-48]
+    ldp x9, x10, [x1, #-64]
+    stp x3, x4, [x0, #-16]
+    stp x5, x6, [x0, #-32]
+    stp x7, x8, [x0, #-48]
+    stp x9, x10, [x0, #-64]
+    sub x1, x1, #64
+    sub x0, x0, #64
+    sub x2, x2, #64
+    b bwd_64
+bwd_16:
+    cmp x2, #16
+    blo bwd_tail
+    ldp x3, x4, [x1, #-16]!
+    stp x3, x4, [x0, #-16]!
+    sub x2, x2, #16
+    b bwd_16
+bwd_tail:
+    cbz x2, memcpy_end
+    ldrb w3, [x1, #-1]!
+    strb w3, [x0, #-1]!
+    subs x2, x2, #1
+    bne bwd_tail
+
+memcpy_end:
+    ret
+
+#ifdef MEMBENCH
+# Byte at a time versions of memset, memcmp and memcpy kept as the baseline for the memory routine benchmark (see mem_benchmark)
+memset_byte:
+    # x0 => dst x1 => value x2 => size
+    cmp x2, #0
+    beq memset_byte_end
+set_byte:
+    # Increment x0 (address of dst) by 1 after we store 1-byte value from w1 register to x0
+    strb w1, [x0], #1
+    # Subtract 1 from x2 and update conditional flags according to result (accomplished by suffix 's' in subs instruction)
+    subs x2, x2, #1
+    bne set_byte
+
+memset_byte_end:
+    ret
+
+memcmp_byte:
+    # x0 => src1 x1 => src2 x2 => size
+    mov x3, x0
+    # We do this to clear the x0 register for possible return value
+    mov x0, #0
+compare_byte:
+    cmp x2, #0
+    beq memcmp_byte_end
+    # Register x3 will increment by 1 afer we load the value in w4
+    ldrb w4, [x3], #1
+    ldrb w5, [x1], #1
+    sub x2, x2, #1
+    cmp w4, w5
+    beq compare_byte
+    # Comparison failed. Return 1
+    mov x0, #1
+
+memcmp_byte_end:
+    ret
+
+memcpy_byte:
     # x0 => dst x1 => src x2 => size
     cmp x2, #0
-    beq memcpy_end
+    beq memcpy_byte_end
     # Temp value used to determine direction of traversal while copying data
     mov x4, #1
 
     cmp x1, x0
     # If x1 is higher or same as x0, start copying from the first byte
-    bhs copy
+    bhs copy_byte
     # x3 = base address in x1 + size
     add x3, x1, x2
     cmp x3, x0
     # If x3 is lower or same as x0 meaning src and dst addresses do NOT overlap
-    bls copy
+    bls copy_byte
 
-overlap:
+overlap_byte:
     # Set src and dst to point to the last index (size - 1) of the memory location
     sub x3, x2, #1
     add x0, x0, x3
@@ -109,7 +364,7 @@ overlap:
     # This is done to copy data backwards from the last index
     neg x4, x4
 
-copy:
+copy_byte:
     # Load 1 byte data from memory address in x1 in w3
     ldrb w3, [x1]
     # Store 1 byte data from w3 in memory address in x0
@@ -118,7 +373,8 @@ copy:
     add x1, x1, x4
     subs x2, x2, #1
     # If size is not zero, continue copying
-    bne copy
+    bne copy_byte
 
-memcpy_end:
+memcpy_byte_end:
     ret
+#endif
@@ -22,9 +22,15 @@
 #include <lib/lib.h>
 #include <irq/handler.h>
 #include <memory/memory.h>
+#include <memory/slab.h>
 #include <fs/file.h>
 #include <process/process.h>
 #include <irq/syscall.h>
+#include <kernel.h>
+
+#define SPIN_TABLE 0xd8 /* Physical address of the entry address slots the secondary cores wait on, 8 bytes per core */
+
+void secondary_entry(void);
 
 /* A dummy non-zero global variable added for the kernel image to contain a data section
    In absence of data section, the image disregards the alignment padding after the rodata section for the disk image
@@ -34,17 +40,41 @@
    Thus, the position of FAT16 image start and kernel end on disk (disk_img_end) can be correctly determined  */
 int dummy_glob = 30;
 
+/* Publish the physical entry address to the spin table slot of every other core and wake them up */
+static void start_secondary_cores(void)
+{
+    for (int cpu = 1; cpu < NCPU; cpu++)
+        *(volatile uint64_t*)TO_VIRT(SPIN_TABLE + cpu*8) = TO_PHY((uint64_t)secondary_entry);
+    send_event();
+}
+
+/* Bring-up of a secondary core, entered with interrupts masked. It returns into the idle loop of the core */
+void secondary_main(void)
+{
+    lock_kernel();
+    init_idle_process();
+    init_cpu_timer();
+    printk("Core %d up\n", cpu_id());
+    unlock_kernel();
+    enable_irq();
+}
+
 void kmain(void)
 {
     printk("\nStarting kernel ...\n");
     init_uart();
     init_mem();
+    init_slab();
     init_fs();
+#ifdef MEMBENCH
+    mem_benchmark();
+#endif
     init_system_call();
     init_timer();
     init_interrupt_controller();
     enable_irq();
     init_process();
+    start_secondary_cores();
 }
 
 void shutdown_banner(void)
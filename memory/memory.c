@@ -22,78 +22,320 @@
 #include <lib/lib.h>
 #include <fs/file.h>
 #include <process/process.h>
-
-static struct Page free_mem_head = {
-    .next = NULL
-};
+#include <irq/handler.h>
+
+/* Free lists of the buddy allocator, one per block order. The heads are sentinels of circular doubly linked lists */
+static struct Page free_area[MAX_ORDER+1];
+static uint32_t free_count[MAX_ORDER+1];
+/* Frame book-keeping array placed at the beginning of free memory and the first frame managed by the allocator */
+static struct PageFrame* frames = NULL;
+static uint64_t mem_start = 0;
+/* Pool of free frames zeroed in the background by the idle process. Frames are linked through their first 8 bytes */
+static struct Page* zero_pool = NULL;
+static uint32_t zero_pool_count = 0;
+/* ASID allocator state. Process ASIDs carry the generation they were allocated in above the ASID bits
+   The allocator starts out exhausted so that the first user process opens a generation, which also drops the global entries cached from the boot tables */
+static uint64_t asid_generation = 0;
+static uint64_t next_asid = ASID_MASK + 1;
+/* ASIDs carried over into the current generation by processes which were running on other cores at the rollover */
+static uint64_t reserved_asids[(ASID_MASK + 1) / 64];
+/* Process whose tables switch_vm last made live on each core. A fault on the user tables is resolved for it without a search */
+static struct Process* live_vm[NCPU];
 /* The symbol used in linker script whose address will mark the end of kernel in the virt address space */
 extern char kern_end;
 void load_gdt(uint64_t map);
+void flush_tlb_asid(uint64_t asid);
+void flush_tlb_page(uint64_t virt_addr, uint64_t asid);
+
+/* Userspace mapping of the process environment rounded up to whole pages */
+#define ENV_SIZE FRAME_ALIGN_UP(sizeof(struct Map))
+
+static struct PageFrame* get_frame(uint64_t addr)
+{
+    return frames + ((addr - mem_start) >> FRAME_SHIFT);
+}
+
+struct PageFrame* get_page_frame(uint64_t addr)
+{
+    ASSERT(addr >= mem_start && addr < MEMORY_END);
+    return get_frame(addr);
+}
+
+static void add_free_block(uint64_t addr, int order)
+{
+    struct Page* page = (struct Page*)addr;
+    struct PageFrame* frame = get_frame(addr);
+
+    frame->order = order;
+    frame->flags |= FRAME_FREE;
+    /* Insert the block just after the list head */
+    page->next = free_area[order].next;
+    page->prev = &free_area[order];
+    free_area[order].next->prev = page;
+    free_area[order].next = page;
+    free_count[order]++;
+}
+
+static void remove_free_block(uint64_t addr, int order)
+{
+    struct Page* page = (struct Page*)addr;
+
+    get_frame(addr)->flags &= ~FRAME_FREE;
+    page->prev->next = page->next;
+    page->next->prev = page->prev;
+    free_count[order]--;
+}
+
+/* Release a block to the free lists merging it with its buddy as long as the buddy is free and of the same order */
+static void free_block(uint64_t addr, int order)
+{
+    uint64_t buddy;
+    struct PageFrame* buddy_frame;
+
+    while (order < MAX_ORDER)
+    {
+        /* Blocks are naturally aligned to their size hence flipping the order bit of the address gives the buddy address */
+        buddy = addr ^ ORDER_SIZE(order);
+        if (buddy < mem_start || buddy + ORDER_SIZE(order) > MEMORY_END)
+            break;
+        buddy_frame = get_frame(buddy);
+        if (!(buddy_frame->flags & FRAME_FREE) || buddy_frame->order != order)
+            break;
+        remove_free_block(buddy, order);
+        /* The merged block starts at the lower of the two buddy addresses */
+        if (buddy < addr)
+            addr = buddy;
+        order++;
+    }
+
+    add_free_block(addr, order);
+}
 
 static void free_region(uint64_t start, uint64_t end)
 {
-    for(uint64_t addr = ALIGN_UP(start); addr + PAGE_SIZE <= end; addr += PAGE_SIZE)
+    uint64_t addr = FRAME_ALIGN_UP(start);
+    int order;
+
+    while (addr + FRAME_SIZE <= end)
     {
-        /* If page is within the region, add it to list of free pages */
-        if (addr + PAGE_SIZE <= MEMORY_END)
-            kfree(addr);
+        /* Carve out the largest naturally aligned block which fits in the remaining region */
+        order = MAX_ORDER;
+        while (order > 0 && ((addr & (ORDER_SIZE(order) - 1)) || addr + ORDER_SIZE(order) > end))
+            order--;
+        free_block(addr, order);
+        addr += ORDER_SIZE(order);
     }
 }
 
-void *kalloc(void)
+int get_order(uint64_t size)
 {
-    struct Page* page = free_mem_head.next;
-    
-    if (page != NULL){
-        /* Assert that the virtual address is page aligned */
-        ASSERT((uint64_t)page % PAGE_SIZE == 0);
-        /* Assert that the virtual address is not within kernel space */
-        ASSERT((uint64_t)page >= (uint64_t)&kern_end);
-        /* Assert that the address is within memory limit */
-        ASSERT((uint64_t)page + PAGE_SIZE <= MEMORY_END);
-
-        free_mem_head.next = page->next;
+    int order = 0;
+
+    while (order < MAX_ORDER && ORDER_SIZE(order) < size)
+        order++;
+
+    return order;
+}
+
+/* Return the frames of the zero pool to the buddy allocator
+   @return true if any frame was released, false if the pool was empty */
+static bool drain_zero_pool(void)
+{
+    struct Page* page;
+    bool released = (zero_pool != NULL);
+
+    while (zero_pool != NULL)
+    {
+        page = zero_pool;
+        zero_pool = page->next;
+        free_block((uint64_t)page, 0);
     }
+    zero_pool_count = 0;
+
+    return released;
+}
+
+static void* alloc_block(int order)
+{
+    struct Page* page = NULL;
+    int curr_order = order;
+
+    /* Find the smallest order with a free block which can satisfy the request */
+    while (curr_order <= MAX_ORDER && free_area[curr_order].next == &free_area[curr_order])
+        curr_order++;
+    if (curr_order > MAX_ORDER)
+        return NULL;
+
+    page = free_area[curr_order].next;
+    /* Assert that the virtual address is aligned to the block size */
+    ASSERT((uint64_t)page % ORDER_SIZE(curr_order) == 0);
+    /* Assert that the virtual address is not within kernel space */
+    ASSERT((uint64_t)page >= (uint64_t)&kern_end);
+    /* Assert that the address is within memory limit */
+    ASSERT((uint64_t)page + ORDER_SIZE(curr_order) <= MEMORY_END);
+    remove_free_block((uint64_t)page, curr_order);
+
+    /* Split the block in halves until we reach the requested order, returning the upper halves to the free lists */
+    while (curr_order > order)
+    {
+        curr_order--;
+        add_free_block((uint64_t)page + ORDER_SIZE(curr_order), curr_order);
+    }
+    get_frame((uint64_t)page)->order = order;
+    get_frame((uint64_t)page)->ref_count = 1;
     
     return page;
 }
 
-/* A test function to print the list of free memory pages and total size in megabytes */
-static void checkmem(void)
+void *kalloc_order(int order)
+{
+    void* page;
+
+    if (order < 0 || order > MAX_ORDER)
+        return NULL;
+
+    page = alloc_block(order);
+    /* Frames held by the zero pool are free memory as well. Give them back and retry before failing */
+    if (page == NULL && drain_zero_pool())
+        page = alloc_block(order);
+
+    return page;
+}
+
+/* Allocate a block which is guaranteed to be zeroed
+   Single frames are taken from the pool zeroed by the idle process, falling back to zeroing synchronously if the pool is empty */
+void* kzalloc_order(int order)
+{
+    struct Page* page;
+
+    if (order == 0 && zero_pool != NULL){
+        page = zero_pool;
+        zero_pool = page->next;
+        zero_pool_count--;
+        /* The pool link is the only non-zero word of the frame */
+        page->next = NULL;
+        get_frame((uint64_t)page)->ref_count = 1;
+        return page;
+    }
+
+    page = kalloc_order(order);
+    if (page != NULL)
+        memset(page, 0, ORDER_SIZE(order));
+
+    return page;
+}
+
+/* Zero free frames into the zero pool until it is full. Called by the idle process with interrupts enabled and the kernel lock
+   released. Only the allocator and pool updates run under the lock with interrupts masked, the idle process stays preemptible while
+   zeroing and never holds the lock while it might be preempted */
+void fill_zero_pool(void)
+{
+    struct Page* page;
+
+    while (true)
+    {
+        disable_irq();
+        lock_kernel();
+        /* Only take frames which are free in the buddy allocator, never the ones drained from the pool */
+        page = (zero_pool_count < ZERO_POOL_SIZE) ? alloc_block(0) : NULL;
+        unlock_kernel();
+        enable_irq();
+        if (page == NULL)
+            break;
+
+        memset(page, 0, FRAME_SIZE);
+
+        disable_irq();
+        lock_kernel();
+        page->next = zero_pool;
+        zero_pool = page;
+        zero_pool_count++;
+        unlock_kernel();
+        enable_irq();
+    }
+}
+
+void *kalloc(void)
+{
+    /* Hand out a whole 2M page */
+    return kalloc_order(MAX_ORDER);
+}
+
+uint64_t get_free_mem(uint32_t* free_blocks)
 {
-    /* Get the first page in the list */
-    struct Page* page = free_mem_head.next;
     uint64_t size = 0;
-    int index = 0;
 
-    while (page != NULL)
+    for (int i = 0; i <= MAX_ORDER; i++)
     {
-        size += PAGE_SIZE;
-        index++;
+        if (free_blocks != NULL)
+            free_blocks[i] = free_count[i];
+        size += free_count[i] * ORDER_SIZE(i);
+    }
+    /* Frames in the zero pool are free single frames */
+    if (free_blocks != NULL)
+        free_blocks[0] += zero_pool_count;
+    size += zero_pool_count * FRAME_SIZE;
 
-        printk("Page number %d: %x\r\n", index, (uint64_t)page);
-        page = page->next;
+    return size;
+}
+
+/* A test function to print the number of free blocks of every order and total size in kilobytes */
+static void checkmem(void)
+{
+    uint32_t free_blocks[MAX_ORDER+1];
+    uint64_t size = get_free_mem(free_blocks);
+
+    for (int i = 0; i <= MAX_ORDER; i++)
+    {
+        printk("Order %d (%uK): %u free\r\n", i, (uint32_t)(ORDER_SIZE(i) >> 10), free_blocks[i]);
     }
 
-    printk("Total free mem: %uM\r\n", size/PAGE_SIZE*2);
+    printk("Zero pool: %u frames\r\n", zero_pool_count);
+    printk("Total free mem: %uK\r\n", (uint32_t)(size >> 10));
 }
 
 void kfree(uint64_t addr)
 {
+    struct PageFrame* frame;
+
     if (addr == 0)
         return;
     
-    /* Assert that the virtual address is page aligned */
-    ASSERT(addr % PAGE_SIZE == 0);
+    /* Assert that the virtual address is frame aligned */
+    ASSERT(addr % FRAME_SIZE == 0);
     /* Assert that the virtual address is not within kernel space */
-    ASSERT(addr >= (uint64_t)&kern_end);
+    ASSERT(addr >= mem_start);
     /* Assert that the address is within memory limit */
-    ASSERT(addr + PAGE_SIZE <= MEMORY_END);
+    ASSERT(addr + FRAME_SIZE <= MEMORY_END);
+
+    frame = get_frame(addr);
+    /* Assert that the block is not freed twice and that the address is the beginning of the allocated block */
+    ASSERT((frame->flags & FRAME_FREE) == 0);
+    ASSERT(addr % ORDER_SIZE(frame->order) == 0);
 
-    /* Add the page to the linked list of free pages just after the head */
-    struct Page* page_addr = (struct Page*)addr;
-    page_addr->next = free_mem_head.next;
-    free_mem_head.next = page_addr;
+    free_block(addr, frame->order);
+}
+
+/* Take another reference to a user frame shared between address spaces */
+static void get_page(uint64_t addr)
+{
+    get_frame(addr)->ref_count++;
+}
+
+/* Drop a reference to a user frame, freeing it once no mapping refers to it */
+static void put_page(uint64_t addr)
+{
+    struct PageFrame* frame = get_frame(addr);
+
+    ASSERT(frame->ref_count > 0);
+    if (--frame->ref_count == 0)
+        kfree(addr);
+}
+
+/* Allocate a zeroed 4K frame to hold a translation table of the next level */
+static uint64_t* alloc_table(void)
+{
+    return kzalloc_order(0);
 }
 
 static uint64_t* find_gdt_entry(uint64_t map, uint64_t virt_addr, int alloc_new, uint64_t attr)
@@ -110,13 +352,10 @@ static uint64_t* find_gdt_entry(uint64_t map, uint64_t virt_addr, int alloc_new,
     if (gdt_addr[gdt_index] & ENTRY_VALID)
         gdt_entry = (uint64_t*)(TO_VIRT(PAGE_DIR_ENTRY_ADDR(gdt_addr[gdt_index])));
     else if (alloc_new){
-        /* Reserve space for the upper directory table (gdt_entry) in the same page after GDT end */
-        gdt_entry = (uint64_t*)(gdt_addr + PAGE_TABLE_ENTRIES);
-        if (gdt_entry != NULL){
-            /* Initialize the upper directory table to all zeros */
-            memset(gdt_entry, 0, PAGE_TABLE_SIZE);
+        /* Allocate a frame for the upper directory table (gdt_entry) */
+        gdt_entry = alloc_table();
+        if (gdt_entry != NULL)
             gdt_addr[gdt_index] = (TO_PHY(gdt_entry) | attr | TABLE_ENTRY);
-        }
     }
 
     return gdt_entry;
@@ -136,20 +375,53 @@ static uint64_t* find_udt_entry(uint64_t map, uint64_t virt_addr, int alloc_new,
     /* For a page directory table if valid bit is clear, the entry is unused */
     if (gdt_entry[udt_index] & ENTRY_VALID)
         udt_entry = (uint64_t*)TO_VIRT(PAGE_DIR_ENTRY_ADDR(gdt_entry[udt_index]));
-    /* If alloc_new is 1, allocate a new page if it does not exist */
+    /* If alloc_new is 1, allocate a new table if it does not exist */
     else if (alloc_new){
-        /* Reserve space for the middle directory table (udt_entry) in the same page after UDT end */
-        udt_entry = (uint64_t*)(gdt_entry + PAGE_TABLE_ENTRIES);
-        if (udt_entry != NULL){
-            /* Initialize the middle directory table to all zeros */
-            memset(udt_entry, 0, PAGE_TABLE_SIZE);
+        /* Allocate a frame for the middle directory table (udt_entry) */
+        udt_entry = alloc_table();
+        if (udt_entry != NULL)
             gdt_entry[udt_index] = (TO_PHY(udt_entry) | attr | TABLE_ENTRY);
-        }
     }
 
     return udt_entry;
 }
 
+static uint64_t* find_mdt_entry(uint64_t map, uint64_t virt_addr, int alloc_new, uint64_t attr)
+{
+    uint64_t* udt_entry, *mdt_entry;
+    udt_entry = mdt_entry = NULL;
+
+    /* 9 bits after 21 bits in LSB holds the index for the middle directory table */
+    unsigned int mdt_index = (virt_addr >> 21) & 0x1ff;
+
+    if (NULL == (udt_entry = find_udt_entry(map, virt_addr, alloc_new, attr)))
+        return NULL;
+
+    /* User space is mapped with 4K pages, so every valid MDT entry points to a page table */
+    if (udt_entry[mdt_index] & ENTRY_VALID)
+        mdt_entry = (uint64_t*)TO_VIRT(PAGE_DIR_ENTRY_ADDR(udt_entry[mdt_index]));
+    else if (alloc_new){
+        /* Allocate a frame for the page table (mdt_entry) */
+        mdt_entry = alloc_table();
+        if (mdt_entry != NULL)
+            udt_entry[mdt_index] = (TO_PHY(mdt_entry) | attr | TABLE_ENTRY);
+    }
+
+    return mdt_entry;
+}
+
+/* Get the page table entry which translates the 4K page containing the virtual address */
+static uint64_t* find_pte(uint64_t map, uint64_t virt_addr, int alloc_new, uint64_t attr)
+{
+    uint64_t* mdt_entry = NULL;
+
+    if (NULL == (mdt_entry = find_mdt_entry(map, virt_addr, alloc_new, attr)))
+        return NULL;
+
+    /* 9 bits just ahead of last 12 bits in the virt address hold the page table index */
+    return &mdt_entry[(virt_addr >> FRAME_SHIFT) & 0x1ff];
+}
+
 /* Map virtual address to corresponding physical page
    @param map Global directory table address value
    @param virt_addr virtual address to be mapped
@@ -159,145 +431,549 @@ static uint64_t* find_udt_entry(uint64_t map, uint64_t virt_addr, int alloc_new,
 bool map_page(uint64_t map, uint64_t virt_addr, uint64_t phy_addr, uint64_t attr)
 {
     /* Get the beginning of the page in which this virtual address falls */
-    uint64_t vstart = ALIGN_DOWN(virt_addr);
-    uint64_t* udt_entry = NULL;
+    uint64_t vstart = FRAME_ALIGN_DOWN(virt_addr);
+    uint64_t* pte = NULL;
 
-    ASSERT(vstart + PAGE_SIZE <= MEMORY_END);
-    ASSERT(phy_addr % PAGE_SIZE == 0);
-    /* Check if physical address falls outside range of free memory */
-    ASSERT(phy_addr + PAGE_SIZE <= TO_PHY(MEMORY_END));
+    ASSERT(vstart < KERNEL_BASE);
+    ASSERT(phy_addr % FRAME_SIZE == 0);
+    /* Check if physical address falls outside range of free memory. Only pages of the filesystem image may lie beyond it */
+    ASSERT(phy_addr + FRAME_SIZE <= TO_PHY(MEMORY_END) || (attr & PAGE_FS));
 
-    /* Get the upper directory table entry corresponding to the virtual address start */
-    if (NULL == (udt_entry = find_udt_entry(map, vstart, 1, attr)))
+    /* Get the page table entry corresponding to the virtual address start */
+    if (NULL == (pte = find_pte(map, vstart, 1, attr)))
         return false;
 
-    /* 9 bits just ahead of last 21 bits in the virt address hold the MDT entry index */
-    unsigned int mdt_index = (vstart >> 21) & 0x1ff;
     /* Check if valid bit is set, which imples page is already used */
-    ASSERT((udt_entry[mdt_index] & ENTRY_VALID) == 0);
+    ASSERT((*pte & ENTRY_VALID) == 0);
 
-    udt_entry[mdt_index] = (phy_addr | attr | PAGE_ENTRY);
+    *pte = (phy_addr | attr | PAGE_DESCRIPTOR);
 
     return true;
 }
 
 void free_page(uint64_t map, uint64_t virt_addr)
 {
-    uint64_t* udt_entry = NULL;
-    unsigned int mdt_index;
-    ASSERT(virt_addr % PAGE_SIZE == 0);
-
-    udt_entry = find_udt_entry(map, virt_addr, 0, 0);
-    if (udt_entry != NULL){
-        mdt_index = (virt_addr >> 21) & 0x1ff;
-        if (udt_entry[mdt_index] & ENTRY_VALID){
-            kfree(TO_VIRT(PAGE_TABLE_ENTRY_ADDR(udt_entry[mdt_index])));
-            /* Clear the entry indicating that it is now unused */
-            udt_entry[mdt_index] = 0;
-        }
+    uint64_t* pte = NULL;
+    ASSERT(virt_addr % FRAME_SIZE == 0);
+
+    pte = find_pte(map, virt_addr, 0, 0);
+    if (pte != NULL && (*pte & ENTRY_VALID)){
+        if ((*pte & PAGE_FS) == 0)
+            put_page(TO_VIRT(PAGE_FRAME_ADDR(*pte)));
+        /* Clear the entry indicating that it is now unused */
+        *pte = 0;
     }
 }
 
+/* Walk the translation tables of a map releasing every mapped frame followed by the tables themselves */
 static void free_tables(uint64_t map)
 {
+    uint64_t* gdt = (uint64_t*)map;
+    uint64_t* udt, *mdt, *pt;
+
+    for (int i = 0; i < PAGE_TABLE_ENTRIES; i++)
+    {
+        if ((gdt[i] & ENTRY_VALID) == 0)
+            continue;
+        udt = (uint64_t*)TO_VIRT(PAGE_DIR_ENTRY_ADDR(gdt[i]));
+        for (int j = 0; j < PAGE_TABLE_ENTRIES; j++)
+        {
+            if ((udt[j] & ENTRY_VALID) == 0)
+                continue;
+            mdt = (uint64_t*)TO_VIRT(PAGE_DIR_ENTRY_ADDR(udt[j]));
+            for (int k = 0; k < PAGE_TABLE_ENTRIES; k++)
+            {
+                if ((mdt[k] & ENTRY_VALID) == 0)
+                    continue;
+                pt = (uint64_t*)TO_VIRT(PAGE_DIR_ENTRY_ADDR(mdt[k]));
+                for (int l = 0; l < PAGE_TABLE_ENTRIES; l++)
+                {
+                    if ((pt[l] & ENTRY_VALID) && (pt[l] & PAGE_FS) == 0)
+                        put_page(TO_VIRT(PAGE_FRAME_ADDR(pt[l])));
+                }
+                kfree((uint64_t)pt);
+            }
+            kfree((uint64_t)mdt);
+        }
+        kfree((uint64_t)udt);
+    }
     kfree(map);
 }
 
 /* Function to free user space memory */
 void free_uvm(uint64_t map)
 {
-    free_page(map, USERSPACE_BASE);
-    free_page(map, USERSPACE_EXT);
+    uint64_t* pte = find_pte(map, USERSPACE_EXT, 0, 0);
+
+    /* The environment is a single buddy block mapped page by page. Free it once through its first frame and drop the remaining entries */
+    if (pte != NULL && (*pte & ENTRY_VALID)){
+        kfree(TO_VIRT(PAGE_FRAME_ADDR(*pte)));
+        for (uint64_t offset = 0; offset < ENV_SIZE; offset += FRAME_SIZE)
+            pte[offset >> FRAME_SHIFT] = 0;
+    }
     free_tables(map);
 }
 
+/* Release every page mapped in the userspace region and the file mappings. The environment and the translation tables are left in place */
+void clear_uvm(struct Process* process)
+{
+    for (uint64_t virt_addr = USERSPACE_BASE; virt_addr < USERSPACE_BASE + USERSPACE_SIZE; virt_addr += FRAME_SIZE)
+        free_page(process->page_map, virt_addr);
+    for (uint64_t virt_addr = USER_MMAP_BASE; virt_addr < process->mmap_top; virt_addr += FRAME_SIZE)
+        free_page(process->page_map, virt_addr);
+    process->mmap_top = 0;
+    /* Drop any stale translations to the released frames */
+    flush_tlb_asid(process->asid & ASID_MASK);
+}
+
+/* Map the process environment to the userspace extended virtual address. The kernel keeps accessing it through its kernel address */
+bool map_env(uint64_t map, uint64_t env)
+{
+    for (uint64_t offset = 0; offset < ENV_SIZE; offset += FRAME_SIZE)
+    {
+        if (!map_page(map, USERSPACE_EXT + offset, TO_PHY(env + offset), USER_PAGE_ATTR))
+            return false;
+    }
+
+    return true;
+}
+
+/* Attach the program image open at fd to the userspace base address of the process
+   Nothing is read here. Pages of the image are read in from the filesystem on their first access (see map_new_page)
+   @return true if the image fits in the userspace region, false otherwise */
+bool load_uvm(struct Process* process, int fd)
+{
+    uint32_t binary_size = get_file_size(process, fd);
+
+    if (binary_size > USERSPACE_SIZE)
+        return false;
+
+    process->image_cluster = get_file_cluster(process, fd);
+    process->image_size = binary_size;
+    /* The program break starts at the end of the image. The program moves it past its bss before using the heap */
+    process->brk = USERSPACE_BASE + binary_size;
+
+    return true;
+}
+
 bool setup_uvm(struct Process* process, char* program_filename)
 {
     uint64_t map = process->page_map;
-    /* Allocate memory to load the process binary. We will later map it to the userspace virtual address */
-    void* proc_page = kalloc();
-
-    if (proc_page != NULL){
-        /* If the page mapping succeeds, load the file into that memory */
-        if (map_page(map, USERSPACE_BASE, TO_PHY(proc_page), ENTRY_VALID | USER_MODE | NORMAL_MEMORY | ENTRY_ACCESSED)){
-            int fd = open_file(process, program_filename);
-            if (fd < 0)
-                goto out;
-            uint32_t binary_size = get_file_size(process, fd);
-            /* Use the read_file function to load the process binary in the memory page allocated */
-            uint32_t bytes_read = read_file(process, fd, proc_page, binary_size);
-            close_file(process, fd);
-            if (binary_size != bytes_read)
-                goto out;
-            /* Map extended page to userspace virtual address space */
-            if (!map_page(map, USERSPACE_EXT, TO_PHY(process->env), ENTRY_VALID | USER_MODE | NORMAL_MEMORY | ENTRY_ACCESSED))
-                goto out;
-            /* Save the mapped userspace extended virtual address to process table. The TTBR0_EL1 register will take care of translation */
-            process->env = USERSPACE_EXT;
-            return true;
-        }
-        kfree((uint64_t)proc_page);
-        return false;
-    }
+    bool loaded;
+    int fd = open_file(process, program_filename);
+
+    if (fd < 0)
+        goto out;
+    loaded = load_uvm(process, fd);
+    close_file(process, fd);
+    if (!loaded)
+        goto out;
+    /* Map extended pages to userspace virtual address space */
+    if (!map_env(map, process->env))
+        goto out;
+    return true;
 
 out:
     free_uvm(map);
     return false;
 }
 
-bool copy_uvm(struct Process* process, uint64_t src_map, char* src_program_filename)
+/* Share the pages mapped in a range of the source address space with the new process */
+static bool share_range(uint64_t map, uint64_t src_map, uint64_t start, uint64_t end)
 {
-    uint64_t* mdt_table;
-    int mdt_index;
-    void* proc_page = kalloc();
+    uint64_t* src_pte;
 
-    if (proc_page != NULL){
-        if (map_page(process->page_map, USERSPACE_BASE, TO_PHY(proc_page), ENTRY_VALID | USER_MODE | NORMAL_MEMORY | ENTRY_ACCESSED)){
-            /* Find the source page to copy contents to the dest page using the middle directory table
-               Note that the UDT entry is nothing but address of the MDT table according to our paging setup */
-            mdt_table = find_udt_entry(src_map, USERSPACE_BASE, 0, 0);
-            if (mdt_table == NULL)
-                goto out;
-            /* 9 bits starting from bit 21 in the virt address signify MDT table index */
-            mdt_index = (USERSPACE_BASE >> 21) & 0x1ff;
-            /* Check if the entry is valid. If not, it means that memory does not belong to current process */
-            ASSERT((mdt_table[mdt_index] & ENTRY_VALID) == 1);
-            /* Get the physical page address of the source */
-            uint64_t src_mem = TO_VIRT(PAGE_TABLE_ENTRY_ADDR(mdt_table[mdt_index]));
-            /* Copy the source to destination */
-            int fd = open_file(process, src_program_filename);
-            if (fd < 0)
-                goto out;
-            uint32_t binary_size = get_file_size(process, fd);
-            close_file(process, fd);
-            memcpy(proc_page, (void*)src_mem, binary_size);
-            /* Copy the bss section of the source process */
-            memcpy(proc_page+binary_size, (void*)(src_mem+binary_size), DEF_BSS_SIZE);
-            /* Copy the source process userspace stack and heap */
-            memcpy((void*)((uint64_t)proc_page+PAGE_SIZE-(STACK_SIZE+HEAP_SIZE)), (void*)(src_mem+PAGE_SIZE-(STACK_SIZE+HEAP_SIZE)), STACK_SIZE+HEAP_SIZE);
-            /* Map extended page to userspace virtual address space */
-            if (!map_page(process->page_map, USERSPACE_EXT, TO_PHY(process->env), ENTRY_VALID | USER_MODE | NORMAL_MEMORY | ENTRY_ACCESSED))
-                goto out;
-            return true;
+    for (uint64_t virt_addr = start; virt_addr < end; virt_addr += FRAME_SIZE)
+    {
+        src_pte = find_pte(src_map, virt_addr, 0, 0);
+        if (src_pte == NULL || (*src_pte & ENTRY_VALID) == 0)
+            continue;
+        if ((*src_pte & READ_ONLY) == 0)
+            *src_pte |= (READ_ONLY | PAGE_COW);
+        if (!map_page(map, virt_addr, PAGE_FRAME_ADDR(*src_pte), USER_PAGE_ATTR | (*src_pte & (READ_ONLY | PAGE_COW | PAGE_FS))))
+            return false;
+        if ((*src_pte & PAGE_FS) == 0)
+            get_page(TO_VIRT(PAGE_FRAME_ADDR(*src_pte)));
+    }
+
+    return true;
+}
+
+/* Share the userspace pages of the source process with the new process instead of copying them
+   Writable pages are turned read-only in both address spaces and marked copy-on-write. The first write to one of them takes
+   a permission fault which gives the writer its own copy (see copy_on_write). File mappings are read-only and simply shared
+   @return false if a table could not be allocated. The tables of the new process are left to the caller to release */
+bool copy_uvm(struct Process* process, struct Process* src)
+{
+    bool copied = false;
+
+    /* Map extended pages to userspace virtual address space first, the environment block is freed along with the tables from then on */
+    if (!map_env(process->page_map, process->env))
+        return false;
+    if (share_range(process->page_map, src->page_map, USERSPACE_BASE, USERSPACE_BASE + USERSPACE_SIZE))
+        copied = share_range(process->page_map, src->page_map, USER_MMAP_BASE, src->mmap_top);
+    /* Drop the cached writable translations of the source process */
+    flush_tlb_asid(src->asid & ASID_MASK);
+
+    return copied;
+}
+
+/* Give a vfork child translation tables of its own in place of the address space it shares with its parent. They hold nothing
+   but a copy of the given environment, the program image is attached afterwards. The child runs on the shared tables until it
+   is switched to the new ones
+   @return true on success, false if the environment could not be mapped in which case the process keeps the shared address space */
+bool unshare_uvm(struct Process* process, uint64_t env)
+{
+    uint64_t map = (uint64_t)kzalloc_order(0);
+    uint64_t new_env = (uint64_t)kalloc_order(get_order(sizeof(struct Map)));
+
+    ASSERT(map != 0);
+    ASSERT(new_env != 0);
+    if (env != 0)
+        memcpy((void*)new_env, (void*)env, sizeof(struct Map));
+    else
+        memset((void*)new_env, 0, sizeof(struct Map));
+    /* Map extended pages to userspace virtual address space */
+    if (!map_env(map, new_env)){
+        free_uvm(map);
+        return false;
+    }
+    process->page_map = map;
+    process->env = new_env;
+    process->mmap_top = 0;
+    /* The ASID was shared as well. A new one is allocated once the process is switched to its tables */
+    process->asid = 0;
+
+    return true;
+}
+
+/* Back the top page of the user stack of a process which is not running, so that the kernel can lay out its program arguments there
+   @return the kernel address of the page, or NULL if memory ran out */
+void* map_stack_top(struct Process* process)
+{
+    void* page = kzalloc_order(0);
+
+    if (page == NULL)
+        return NULL;
+    if (!map_page(process->page_map, USERSPACE_BASE + USERSPACE_SIZE - FRAME_SIZE, TO_PHY(page), USER_PAGE_ATTR)){
+        kfree((uint64_t)page);
+        return NULL;
+    }
+
+    return page;
+}
+
+/* Back a user page on its first access. Pages covering the program image are read in from the filesystem and the rest are zero filled
+   The part of the last image page beyond the end of the image starts off as a clean bss */
+static bool map_new_page(struct Process* process, uint64_t map, uint64_t virt_addr)
+{
+    uint32_t offset = FRAME_ALIGN_DOWN(virt_addr) - USERSPACE_BASE;
+    uint32_t read_size = 0;
+    void* page;
+
+    if (offset < process->image_size){
+        if (NULL == (page = kalloc_order(0)))
+            return false;
+        read_size = (process->image_size - offset < FRAME_SIZE) ? process->image_size - offset : FRAME_SIZE;
+        if (read_raw_data(process->image_cluster, page, offset, read_size) != read_size){
+            kfree((uint64_t)page);
+            return false;
         }
-        kfree((uint64_t)proc_page);
+        memset(page + read_size, 0, FRAME_SIZE - read_size);
+    }
+    else if (NULL == (page = kzalloc_order(0)))
+        return false;
+    if (!map_page(map, virt_addr, TO_PHY(page), USER_PAGE_ATTR)){
+        kfree((uint64_t)page);
         return false;
     }
 
+    return true;
+}
+
+/* Resolve a write to a copy-on-write page. The last process sharing a frame takes it over without copying */
+static bool copy_on_write(uint64_t map, uint64_t virt_addr)
+{
+    uint64_t* pte = find_pte(map, virt_addr, 0, 0);
+    uint64_t frame_addr;
+    void* page;
+
+    if (pte == NULL || (*pte & PAGE_COW) == 0)
+        return false;
+
+    frame_addr = TO_VIRT(PAGE_FRAME_ADDR(*pte));
+    if (get_frame(frame_addr)->ref_count > 1){
+        if (NULL == (page = kalloc_order(0)))
+            return false;
+        memcpy(page, (void*)frame_addr, FRAME_SIZE);
+        *pte = TO_PHY(page) | (*pte & ~PAGE_FRAME_ADDR(*pte));
+        put_page(frame_addr);
+    }
+    *pte &= ~(READ_ONLY | PAGE_COW);
+
+    return true;
+}
+
+/* Service a page fault raised on user memory of the current address space
+   Pages of the userspace region are paged in from the program image or zero filled the first time they are touched and
+   the first write to a page shared by fork gives the writer a private copy of it
+   @param esr Exception syndrome register value of the fault
+   @param fault_addr Faulting virtual address
+   @return true if the fault was resolved and the faulting instruction can be retried, false otherwise */
+bool handle_page_fault(uint64_t esr, uint64_t fault_addr)
+{
+    uint32_t ec = ESR_EC(esr);
+    uint64_t map;
+    struct Process* process;
+    bool resolved = false;
+
+    if (ec != EC_DABT_LOWER && ec != EC_DABT_CURR && ec != EC_IABT_LOWER)
+        return false;
+    if (fault_addr < USERSPACE_BASE || fault_addr >= USERSPACE_BASE + USERSPACE_SIZE)
+        return false;
+
+    /* The live tables need not belong to the current process, the kernel switches to another process' tables to deliver its signals
+       The empty tables of the idle processes and the kernel threads have no room for user pages. A fault taken by a vfork child is
+       resolved for the lender of its tables, only the image fields of the owner describe them */
+    map = TO_VIRT(PAGE_DIR_ENTRY_ADDR(read_gdt()));
+    process = live_vm[cpu_id()];
+    if (process == NULL || process->pid == 0 || process->kthread)
+        return false;
+    if (process->vm_lender != NULL)
+        process = process->vm_lender;
+    if (process->page_map != map)
+        return false;
+
+    switch (FSC_TYPE(ESR_FSC(esr)))
+    {
+    case FSC_TRANSLATION:
+        resolved = map_new_page(process, map, fault_addr);
+        break;
+    case FSC_PERMISSION:
+        /* Only writes to pages shared by fork are expected to fault on permissions */
+        if (ec != EC_IABT_LOWER && (esr & ESR_WNR))
+            resolved = copy_on_write(map, fault_addr);
+        break;
+    default:
+        break;
+    }
+    /* Make the updated entry visible to the table walker and drop any stale translation before the faulting access is retried */
+    if (resolved)
+        flush_tlb_page(fault_addr, process->asid & ASID_MASK);
+
+    return resolved;
+}
+
+/* Move the program break of a process. Heap pages are zero filled on first access like the rest of the userspace region
+   and the pages left above a lowered break are released
+   @param brk New program break or 0 to query the current one
+   @return The program break after the call. It is left unchanged if the requested break is out of range */
+uint64_t set_brk(struct Process* process, uint64_t brk)
+{
+    if (brk < USERSPACE_BASE + process->image_size || brk > USER_BRK_LIMIT)
+        return process->brk;
+
+    if (brk < process->brk){
+        for (uint64_t virt_addr = FRAME_ALIGN_UP(brk); virt_addr < FRAME_ALIGN_UP(process->brk); virt_addr += FRAME_SIZE)
+            free_page(process->page_map, virt_addr);
+        flush_tlb_asid(process->asid & ASID_MASK);
+    }
+    process->brk = brk;
+
+    return process->brk;
+}
+
+/* Find room for a number of consecutive pages in the file mapping region of a process
+   @return User virtual address of the first free page of the run or 0 if the region has no room left */
+static uint64_t find_mmap_area(struct Process* process, uint64_t size)
+{
+    uint64_t* pte;
+    uint64_t start = USER_MMAP_BASE;
+
+    for (uint64_t virt_addr = USER_MMAP_BASE; virt_addr < USER_MMAP_BASE + USER_MMAP_SIZE; virt_addr += FRAME_SIZE)
+    {
+        pte = find_pte(process->page_map, virt_addr, 0, 0);
+        if (pte != NULL && (*pte & ENTRY_VALID)){
+            start = virt_addr + FRAME_SIZE;
+            continue;
+        }
+        if (virt_addr + FRAME_SIZE - start == size)
+            return start;
+        /* Nothing is mapped beyond the highest mapping */
+        if (virt_addr >= process->mmap_top && start + size <= USER_MMAP_BASE + USER_MMAP_SIZE)
+            return start;
+    }
+
+    return 0;
+}
+
+/* Map size bytes of an open file starting at a frame aligned offset read-only into the file mapping region of a process
+   Pages which lie in consecutive clusters of the filesystem image at a frame aligned address are mapped in place without copying
+   The rest, and a partial last page which would otherwise expose the data following the file in the image, get a private copy
+   @param size Number of bytes to map. 0 or a size reaching beyond the end of file maps the rest of the file
+   @return User virtual address of the mapping or 0 on failure */
+uint64_t map_file(struct Process* process, int fd, uint32_t offset, uint32_t size)
+{
+    uint32_t file_size, cluster_index, cluster_base = 0;
+    uint32_t page_offset = 0, read_size;
+    uint64_t virt_base, data;
+    void* page;
+
+    if (fd < 0 || fd >= MAX_OPEN_FILES || process->fd_table[fd] == NULL || offset % FRAME_SIZE != 0)
+        return 0;
+    file_size = get_file_size(process, fd);
+    if (offset >= file_size)
+        return 0;
+    if (size == 0 || size > file_size - offset)
+        size = file_size - offset;
+    if (0 == (virt_base = find_mmap_area(process, FRAME_ALIGN_UP(size))))
+        return 0;
+
+    cluster_index = get_file_cluster(process, fd);
+    for (; page_offset < size; page_offset += FRAME_SIZE)
+    {
+        read_size = (size - page_offset < FRAME_SIZE) ? size - page_offset : FRAME_SIZE;
+        data = get_data_addr(&cluster_index, &cluster_base, offset + page_offset, read_size);
+        if (read_size == FRAME_SIZE && data % FRAME_SIZE == 0 && data != 0){
+            if (!map_page(process->page_map, virt_base + page_offset, TO_PHY(data), USER_PAGE_ATTR | READ_ONLY | PAGE_FS))
+                goto out;
+            continue;
+        }
+        if (NULL == (page = kzalloc_order(0)))
+            goto out;
+        if (data != 0)
+            memcpy(page, (void*)data, read_size);
+        else if (read_raw_data(cluster_index, page, offset + page_offset - cluster_base, read_size) != read_size){
+            kfree((uint64_t)page);
+            goto out;
+        }
+        if (!map_page(process->page_map, virt_base + page_offset, TO_PHY(page), USER_PAGE_ATTR | READ_ONLY)){
+            kfree((uint64_t)page);
+            goto out;
+        }
+    }
+    if (virt_base + page_offset > process->mmap_top)
+        process->mmap_top = virt_base + page_offset;
+
+    return virt_base;
+
 out:
-    free_uvm(process->page_map);
-    return false;
+    for (uint64_t virt_addr = virt_base; virt_addr < virt_base + page_offset; virt_addr += FRAME_SIZE)
+        free_page(process->page_map, virt_addr);
+    return 0;
+}
+
+/* Remove the file mapping pages of a process covering a range. Pages brought in by a copy are freed
+   @return 0 on success, -1 if the range is not frame aligned or lies outside the file mapping region */
+int unmap_file(struct Process* process, uint64_t virt_addr, uint32_t size)
+{
+    uint64_t end = FRAME_ALIGN_UP(virt_addr + size);
+
+    if (virt_addr % FRAME_SIZE != 0 || virt_addr < USER_MMAP_BASE || end > USER_MMAP_BASE + USER_MMAP_SIZE)
+        return -1;
+
+    for (; virt_addr < end && virt_addr < process->mmap_top; virt_addr += FRAME_SIZE)
+        free_page(process->page_map, virt_addr);
+    flush_tlb_asid(process->asid & ASID_MASK);
+
+    return 0;
 }
 
-void switch_vm(uint64_t map)
+/* Start a new ASID generation, every process gets a new ASID the next time it runs
+   The ASIDs of processes running on other cores are live in their TTBR0 and carry over into the new generation as they are */
+static void new_asid_generation(void)
 {
-    /* Load the TTBR0 register with global directory table address */
-    load_gdt(TO_PHY(map));
+    struct Process* process;
+    uint64_t asid;
+
+    asid_generation += (1UL << ASID_BITS);
+    next_asid = 1;
+    memset(reserved_asids, 0, sizeof(reserved_asids));
+    for (int cpu = 0; cpu < NCPU; cpu++)
+    {
+        process = get_cpu_process(cpu);
+        if (cpu == cpu_id() || process == NULL || process->pid == 0 || (process->asid & ASID_MASK) == 0)
+            continue;
+        asid = process->asid & ASID_MASK;
+        process->asid = asid_generation | asid;
+        reserved_asids[asid / 64] |= (1UL << (asid % 64));
+    }
+}
+
+/* Hand out the next free ASID of the current generation
+   @return the ASID tagged with its generation. Rollover is set if a new generation had to be started for it */
+static uint64_t alloc_asid(bool* rollover)
+{
+    while (1)
+    {
+        if (next_asid > ASID_MASK){
+            new_asid_generation();
+            *rollover = true;
+        }
+        if (!(reserved_asids[next_asid / 64] & (1UL << (next_asid % 64))))
+            break;
+        next_asid++;
+    }
+
+    return asid_generation | next_asid++;
+}
+
+void switch_vm(struct Process* process)
+{
+    struct Process* owner = process->vm_lender != NULL ? process->vm_lender : process;
+    uint64_t ttbr;
+    bool rollover = false;
+
+    live_vm[cpu_id()] = process;
+    /* The idle process runs in kernel space only. Its tables are empty and tagged with the reserved ASID 0, so that an idling core
+       neither walks nor caches the tables of a process which may be torn down, or whose ASID is handed out again, in the meantime
+       Kernel threads run on empty tables of their own in the same way */
+    if (process->pid == 0 || process->kthread){
+        ttbr = TO_PHY(process->page_map);
+        if (read_gdt() != ttbr)
+            load_gdt(ttbr);
+        return;
+    }
+
+    /* Allocate a new ASID if the process has none or holds one from a previous generation. All ASIDs of a generation being taken starts a new one
+       A vfork child runs on the tables of its parent and hence under the ASID of the parent */
+    if ((owner->asid & ASID_MASK) == 0 || (owner->asid & ~ASID_MASK) != asid_generation)
+        owner->asid = alloc_asid(&rollover);
+    process->asid = owner->asid;
+
+    ttbr = TO_PHY(process->page_map) | ((process->asid & ASID_MASK) << ASID_TTBR_SHIFT);
+    /* Skip the reload if the tables of the process are already live */
+    if (read_gdt() != ttbr)
+        load_gdt(ttbr);
+    /* ASIDs of the previous generation are handed out again. Flush them only once the old tables are no longer live */
+    if (rollover)
+        flush_tlb();
+}
+
+/* Drop the translations of an address space which is being torn down */
+void release_asid(struct Process* process)
+{
+    /* An ASID of an older generation may already belong to another process and its translations went away with the rollover flush */
+    if ((process->asid & ASID_MASK) != 0 && (process->asid & ~ASID_MASK) == asid_generation)
+        flush_tlb_asid(process->asid & ASID_MASK);
+    process->asid = 0;
 }
 
 void init_mem(void)
 {
-    /* Free region from end of the kernel to allocated memory end for the kernel */
-    free_region((uint64_t)&kern_end, MEMORY_END);
+    uint64_t frame_count;
+
+    for (int i = 0; i <= MAX_ORDER; i++)
+    {
+        free_area[i].next = free_area[i].prev = &free_area[i];
+        free_count[i] = 0;
+    }
+    /* Reserve room for the frame book-keeping array right after the end of the kernel */
+    frames = (struct PageFrame*)FRAME_ALIGN_UP(&kern_end);
+    frame_count = (MEMORY_END - (uint64_t)frames) >> FRAME_SHIFT;
+    memset(frames, 0, frame_count * sizeof(struct PageFrame));
+    mem_start = FRAME_ALIGN_UP((uint64_t)frames + frame_count * sizeof(struct PageFrame));
+    /* Free region from end of the frame array to allocated memory end for the kernel */
+    free_region(mem_start, MEMORY_END);
     //checkmem();
 }
\ No newline at end of file
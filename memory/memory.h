@@ -23,14 +23,29 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+/* Free block header stored in the first bytes of every free buddy block */
 struct Page
 {
     struct Page* next;
+    struct Page* prev;
+};
+
+/* Book-keeping data maintained by the buddy allocator for every 4K frame of free memory */
+struct PageFrame
+{
+    uint8_t order; /* Order of the block this frame heads. Only valid for the first frame of a block */
+    uint8_t flags;
+    uint16_t ref_count; /* Number of user mappings sharing this frame. A frame is freed when its last mapping goes away */
 };
 
 #define KERNEL_BASE     0xffff000000000000  /* Kernel base virtual address */
 #define USERSPACE_BASE  0x0000000000400000  /* Userspace base virtual address */
 #define USERSPACE_EXT   0x0000000000600000  /* Userspace extended virtual address base */
+#define USERSPACE_SIZE  0x200000            /* Size of the userspace region below the extended base mapped in 4K pages */
+#define USER_STACK_SIZE 0x20000             /* Room reserved for the user stack at the top of the userspace region which the break never crosses */
+#define USER_BRK_LIMIT  (USERSPACE_BASE + USERSPACE_SIZE - USER_STACK_SIZE)
+#define USER_MMAP_BASE  0x0000000001000000  /* Base of the userspace region holding file mappings */
+#define USER_MMAP_SIZE  0x4000000           /* Size of the file mapping region, large enough to map the whole filesystem image (64M) */
 
 #define TO_VIRT(physical_addr)  ((uint64_t)physical_addr + KERNEL_BASE)
 #define TO_PHY(virt_addr)       ((uint64_t)virt_addr - KERNEL_BASE)
@@ -41,36 +56,87 @@ struct Page
                 user_virt_addr; \
 })
 
-#define MEMORY_END          TO_VIRT(0X30000000)
+#define MEMORY_END          TO_VIRT(0x34000000)
 #define PAGE_SIZE           0x200000 // 2M (2*1024*1024)
+#define FRAME_SIZE          0x1000 // 4K, smallest block handed out by the buddy allocator
+#define FRAME_SHIFT         12
+#define MAX_ORDER           9 // Largest buddy block is 2^9 frames i.e. one 2M page
 #define PAGE_TABLE_ENTRIES  512
 #define PAGE_TABLE_SIZE     4096
 
 #define ALIGN_UP(addr)      ((((uint64_t)addr + PAGE_SIZE - 1) >> 21) << 21)
 #define ALIGN_DOWN(addr)    (((uint64_t)addr >> 21) << 21)
+#define FRAME_ALIGN_UP(addr)    ((((uint64_t)addr + FRAME_SIZE - 1) >> FRAME_SHIFT) << FRAME_SHIFT)
+#define FRAME_ALIGN_DOWN(addr)  (((uint64_t)addr >> FRAME_SHIFT) << FRAME_SHIFT)
+#define ORDER_SIZE(order)       ((uint64_t)FRAME_SIZE << (order))
+
+#define FRAME_FREE      (1 << 0) /* Frame heads a block which is currently on a free list */
+#define FRAME_SLAB      (1 << 1) /* Frame belongs to a slab. The order field holds the slab order for every frame of the slab */
 
-/* Translation table base register and directory tables GDT, UDT are 4k byte aligned hence bitwise AND with remaining bits will give the address of the next level table */
-#define PAGE_DIR_ENTRY_ADDR(value)      ((uint64_t)value & 0xfffffffffffff000)
-/* The middle directory table is 2M aligned (because of page size) hence the following bitmask to get the page address */
-#define PAGE_TABLE_ENTRY_ADDR(value)    ((uint64_t)value & 0xffffffffffe00000)
+#define ZERO_POOL_SIZE  256 /* Max number of pre-zeroed 4K frames kept by the idle process (1M) */
+
+/* Translation table base register and directory tables GDT, UDT, MDT are 4k byte aligned hence bitwise AND with remaining bits will give the address of the next level table */
+#define PAGE_DIR_ENTRY_ADDR(value)      ((uint64_t)value & 0x0000fffffffff000)
+/* Kernel blocks in the middle directory table are 2M aligned (because of page size) hence the following bitmask to get the page address */
+#define PAGE_TABLE_ENTRY_ADDR(value)    ((uint64_t)value & 0x0000ffffffe00000)
+/* User pages are 4K frames. Bits [47:12] of a page table entry hold the frame address, the rest are attributes */
+#define PAGE_FRAME_ADDR(value)          ((uint64_t)value & 0x0000fffffffff000)
 
 #define ENTRY_VALID     (1 << 0)
 #define TABLE_ENTRY     (1 << 1)
 #define PAGE_ENTRY      (0 << 1)
+#define PAGE_DESCRIPTOR (1 << 1) /* Bits [1:0] of a valid 4K page table entry read 0b11 unlike a 2M block entry */
 #define ENTRY_ACCESSED  (1 << 10)
 #define NORMAL_MEMORY   (1 << 2)
 #define DEVICE_MEMORY   (0 << 2)
 #define USER_MODE       (1 << 6)
+#define READ_ONLY       (1 << 7)
+#define NOT_GLOBAL      (1 << 11) /* Translation is tagged with the ASID of the address space in the TLB */
+#define PAGE_COW        (1UL << 55) /* Software bit marking a read-only user page shared with copy-on-write semantics */
+#define PAGE_FS         (1UL << 56) /* Software bit marking a user page mapping the filesystem image in place. Its frame is not owned by the allocator */
+#define USER_PAGE_ATTR  (ENTRY_VALID | USER_MODE | NORMAL_MEMORY | ENTRY_ACCESSED | NOT_GLOBAL)
+
+#define ASID_BITS       8
+#define ASID_MASK       ((1UL << ASID_BITS) - 1)
+#define ASID_TTBR_SHIFT 48 /* ASID position in TTBR0 */
+
+/* Exception syndrome fields used to decode aborts */
+#define ESR_EC(esr)         (((uint64_t)(esr) >> 26) & 0x3f)
+#define ESR_FSC(esr)        ((uint64_t)(esr) & 0x3f)
+#define EC_IABT_LOWER       0x20 /* Instruction abort from EL0 */
+#define EC_DABT_LOWER       0x24 /* Data abort from EL0 */
+#define EC_DABT_CURR        0x25 /* Data abort from EL1 */
+#define FSC_TYPE(fsc)       ((fsc) & 0x3c) /* Fault status code without the translation level bits */
+#define FSC_TRANSLATION     0x04
+#define FSC_PERMISSION      0x0c
+#define ESR_WNR             (1 << 6) /* Set in the syndrome of a data abort caused by a write */
 
 struct Process;
 
 void* kalloc(void);
+void* kalloc_order(int order);
+void* kzalloc_order(int order);
+void fill_zero_pool(void);
 void kfree(uint64_t addr);
+int get_order(uint64_t size);
+struct PageFrame* get_page_frame(uint64_t addr);
+uint64_t get_free_mem(uint32_t* free_blocks);
 void init_mem(void);
 void free_uvm(uint64_t map);
 bool setup_uvm(struct Process* process, char* program_filename);
-bool copy_uvm(struct Process* process, uint64_t src_map, char* src_program_filename);
-void switch_vm(uint64_t map);
+bool load_uvm(struct Process* process, int fd);
+void clear_uvm(struct Process* process);
+bool copy_uvm(struct Process* process, struct Process* src);
+bool map_env(uint64_t map, uint64_t env);
+bool unshare_uvm(struct Process* process, uint64_t env);
+void* map_stack_top(struct Process* process);
+bool handle_page_fault(uint64_t esr, uint64_t fault_addr);
+uint64_t set_brk(struct Process* process, uint64_t brk);
+uint64_t map_file(struct Process* process, int fd, uint32_t offset, uint32_t size);
+int unmap_file(struct Process* process, uint64_t virt_addr, uint32_t size);
+void switch_vm(struct Process* process);
+void release_asid(struct Process* process);
 uint64_t read_gdt(void);
+void flush_tlb(void);
 
 #endif
\ No newline at end of file
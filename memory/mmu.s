@@ -29,6 +29,9 @@
 .global setup_vm
 .global load_gdt
 .global read_gdt
+.global flush_tlb
+.global flush_tlb_asid
+.global flush_tlb_page
 
 read_gdt:
     mrs x0, ttbr0_el1
@@ -36,13 +39,40 @@ read_gdt:
 
 load_gdt:
     # Switch to userspace translation by loading ttbr0 with user space GDT address received as first parameter
+    # The ASID of the address space is held in bits [63:48] of the value. User page translations are tagged with it in the
+    # Translation Lookaside Buffer (a cache of recently accessed page translations in the MMU), hence translations of other
+    # processes and the global kernel translations stay valid across the switch and the TLB needn't be invalidated
     msr ttbr0_el1, x0
-    # Translation Lookaside Buffer is a cache of recently accessed page translations in the MMU
-    # Invalidate the translation lookaside buffer since we are switching paging from kernel to user space
+    # (Instruction sync barrier) Flush the pipeline in the processor so that all instructions after isb use the new translation
+    isb
+    ret
+
+flush_tlb:
+    # Make prior page table updates visible to the table walker before dropping all cached translations
+    dsb ishst
     tlbi vmalle1is
-    # (Data sync barrier) No instruction in program order executes until this instruction completes
     dsb ish
-    # (Instruction sync barrier) Flush the pipeline in the processor so that all instructions after isb are fetched from cache or memory
+    isb
+    ret
+
+flush_tlb_asid:
+    # Drop all cached translations tagged with the ASID received as first parameter
+    dsb ishst
+    # The tlbi operand holds the ASID in bits [63:48]
+    lsl x0, x0, #48
+    tlbi aside1is, x0
+    dsb ish
+    isb
+    ret
+
+flush_tlb_page:
+    # Drop the cached translation of a single user page whose virtual address and ASID are received as first and second parameters
+    dsb ishst
+    # The tlbi operand holds the virtual page number i.e. bits [55:12] of the address in bits [43:0] and the ASID in bits [63:48]
+    lsr x0, x0, #12
+    bfi x0, x1, #48, #16
+    tlbi vae1is, x0
+    dsb ish
     isb
     ret
 
@@ -58,7 +88,9 @@ enable_mmu:
     ldr x0, =MAITR_ATTR
     msr mair_el1, x0
 
-    # Set the TCR system register to set granule size to 4K, 48 bit virt address and 2M page size
+    # Set the TCR system register to set granule size to 4K and 48 bit virt address
+    # The kernel (ttbr1) is mapped with 2M blocks while user space (ttbr0) is mapped with 4K pages
+    # TCR.AS and TCR.A1 are left clear, which selects 8-bit ASIDs taken from ttbr0
     ldr x0, =TCR_VALUE
     msr tcr_el1, x0
 
@@ -86,7 +118,7 @@ setup_kvm:
     # Save address of middle directory table to upper directory entry
     str x1, [x0]
 
-    # Save the memory end to x2 which includes the kernel and filesystem (0x30000000 - 0x34000000) on physical memory
+    # Save the memory end to x2 which includes the kernel, the filesystem appended to it and the free memory after them
     mov x2, #0x34000000
     adr x1, pmd_ttbr1
     # Kernel space is mapped to virtual address space with upper 16 bits set to high (0xFFFF000000000000)
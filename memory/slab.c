@@ -0,0 +1,261 @@
+/**
+    Frostbyte kernel and operating system
+    Copyright (C) 2023  Amol Dhamale <amoldhamale1105@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "slab.h"
+#include "memory.h"
+#include <debug/debug.h>
+#include <io/print.h>
+#include <lib/lib.h>
+
+/* Objects of a slab start after the slab header rounded up to the object alignment */
+#define SLAB_HEADER_SIZE    ((sizeof(struct Slab) + SLAB_OBJ_ALIGN - 1) & ~(SLAB_OBJ_ALIGN - 1))
+#define SLAB_BASE(addr, order)  ((uint64_t)(addr) & ~(ORDER_SIZE(order) - 1))
+
+/* The cache of cache descriptors is set up statically since every other cache is allocated from it */
+static struct KmemCache cache_cache;
+static struct KmemCache* cache_list = NULL;
+static struct KmemCache* kmalloc_caches[KMALLOC_CACHES];
+static const char* kmalloc_names[KMALLOC_CACHES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128", "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048"
+};
+
+static void init_slab_list(struct Slab* head)
+{
+    head->next = head->prev = head;
+}
+
+static bool slab_list_empty(struct Slab* head)
+{
+    return head->next == head;
+}
+
+static void add_slab(struct Slab* head, struct Slab* slab)
+{
+    slab->next = head->next;
+    slab->prev = head;
+    head->next->prev = slab;
+    head->next = slab;
+}
+
+static void remove_slab(struct Slab* slab)
+{
+    slab->prev->next = slab->next;
+    slab->next->prev = slab->prev;
+}
+
+static void setup_cache(struct KmemCache* cache, const char* name, uint32_t size, KMEM_CTOR ctor)
+{
+    int name_len = strlen(name);
+
+    memset(cache, 0, sizeof(struct KmemCache));
+    memcpy(cache->name, (char*)name, name_len < sizeof(cache->name) ? name_len : sizeof(cache->name)-1);
+    cache->obj_size = (size + SLAB_OBJ_ALIGN - 1) & ~(SLAB_OBJ_ALIGN - 1);
+    /* Pick the smallest slab order which holds enough objects to amortize the slab header and the buddy allocator calls */
+    while (cache->order < MAX_SLAB_ORDER && (ORDER_SIZE(cache->order) - SLAB_HEADER_SIZE) / cache->obj_size < MIN_OBJS_PER_SLAB)
+        cache->order++;
+    cache->objs_per_slab = (ORDER_SIZE(cache->order) - SLAB_HEADER_SIZE) / cache->obj_size;
+    ASSERT(cache->objs_per_slab > 0);
+    cache->ctor = ctor;
+    init_slab_list(&cache->partial);
+    init_slab_list(&cache->full);
+    init_slab_list(&cache->empty);
+    /* Add the cache to the global list used for statistics */
+    cache->next = cache_list;
+    cache_list = cache;
+}
+
+/* Tag or untag every frame of a slab so that kmfree can find the slab header from any object address */
+static void mark_slab_frames(struct Slab* slab, int order, bool slab_frames)
+{
+    struct PageFrame* frame;
+
+    for (uint64_t offset = 0; offset < ORDER_SIZE(order); offset += FRAME_SIZE)
+    {
+        frame = get_page_frame((uint64_t)slab + offset);
+        if (slab_frames){
+            frame->flags |= FRAME_SLAB;
+            frame->order = order;
+        }
+        else
+            frame->flags &= ~FRAME_SLAB;
+    }
+}
+
+static struct Slab* grow_cache(struct KmemCache* cache)
+{
+    struct Slab* slab = kalloc_order(cache->order);
+    uint64_t obj;
+
+    if (slab == NULL)
+        return NULL;
+
+    mark_slab_frames(slab, cache->order, true);
+    slab->cache = cache;
+    slab->in_use = 0;
+    slab->free_list = NULL;
+    /* Thread the free list through the objects so that the lowest address is handed out first */
+    for (int i = cache->objs_per_slab - 1; i >= 0; i--)
+    {
+        obj = (uint64_t)slab + SLAB_HEADER_SIZE + i * cache->obj_size;
+        *(void**)obj = slab->free_list;
+        slab->free_list = (void*)obj;
+    }
+    add_slab(&cache->empty, slab);
+    cache->slab_count++;
+
+    return slab;
+}
+
+static void release_slab(struct KmemCache* cache, struct Slab* slab)
+{
+    ASSERT(slab->in_use == 0);
+    remove_slab(slab);
+    mark_slab_frames(slab, cache->order, false);
+    kfree((uint64_t)slab);
+    cache->slab_count--;
+}
+
+/* Create a cache of objects of the same size
+   @param name Cache name shown in the statistics
+   @param size Object size in bytes
+   @param ctor Optional constructor run on every object handed out by the cache, NULL otherwise
+   @return The new cache or NULL if the object is too large for a slab or no memory is left */
+struct KmemCache* kmem_cache_create(const char* name, uint32_t size, KMEM_CTOR ctor)
+{
+    struct KmemCache* cache;
+
+    if (size == 0 || size > ORDER_SIZE(MAX_SLAB_ORDER) - SLAB_HEADER_SIZE)
+        return NULL;
+
+    cache = kmem_cache_alloc(&cache_cache);
+    if (cache != NULL)
+        setup_cache(cache, name, size, ctor);
+
+    return cache;
+}
+
+void* kmem_cache_alloc(struct KmemCache* cache)
+{
+    struct Slab* slab;
+    void* obj;
+
+    /* Fill partially used slabs first to keep the slab count down, then reuse empty slabs before growing the cache */
+    if (!slab_list_empty(&cache->partial))
+        slab = cache->partial.next;
+    else if (!slab_list_empty(&cache->empty))
+        slab = cache->empty.next;
+    else if (NULL == (slab = grow_cache(cache)))
+        return NULL;
+
+    obj = slab->free_list;
+    slab->free_list = *(void**)obj;
+    slab->in_use++;
+    remove_slab(slab);
+    add_slab(slab->in_use == cache->objs_per_slab ? &cache->full : &cache->partial, slab);
+    cache->active_objs++;
+    cache->alloc_count++;
+
+    if (cache->ctor != NULL)
+        cache->ctor(obj);
+
+    return obj;
+}
+
+void kmem_cache_free(struct KmemCache* cache, void* obj)
+{
+    struct Slab* slab;
+
+    if (obj == NULL)
+        return;
+
+    slab = (struct Slab*)SLAB_BASE(obj, cache->order);
+    /* Assert that the object belongs to this cache and is not freed twice into an empty slab */
+    ASSERT(slab->cache == cache);
+    ASSERT(slab->in_use > 0);
+
+    *(void**)obj = slab->free_list;
+    slab->free_list = obj;
+    slab->in_use--;
+    remove_slab(slab);
+    /* Empty slabs stay with the cache until it is shrunk. A freed object thus keeps its type and the next allocation needs no buddy call */
+    add_slab(slab->in_use == 0 ? &cache->empty : &cache->partial, slab);
+    cache->active_objs--;
+    cache->free_count++;
+}
+
+/* Return the empty slabs of a cache to the buddy allocator */
+void kmem_cache_shrink(struct KmemCache* cache)
+{
+    while (!slab_list_empty(&cache->empty))
+        release_slab(cache, cache->empty.next);
+}
+
+/* Allocate a buffer from the smallest kmalloc cache which fits the requested size
+   Requests larger than the largest cache get a buddy block of their own */
+void* kmalloc(uint32_t size)
+{
+    int index = 0;
+
+    if (size == 0)
+        return NULL;
+    if (size > (1 << KMALLOC_MAX_SHIFT))
+        return size > ORDER_SIZE(MAX_ORDER) ? NULL : kalloc_order(get_order(size));
+
+    while ((1U << (index + KMALLOC_MIN_SHIFT)) < size)
+        index++;
+
+    return kmem_cache_alloc(kmalloc_caches[index]);
+}
+
+void kmfree(void* addr)
+{
+    struct PageFrame* frame;
+
+    if (addr == NULL)
+        return;
+
+    frame = get_page_frame(FRAME_ALIGN_DOWN(addr));
+    if (frame->flags & FRAME_SLAB)
+        kmem_cache_free(((struct Slab*)SLAB_BASE(addr, frame->order))->cache, addr);
+    else
+        kfree((uint64_t)addr);
+}
+
+/* Print the usage statistics of every cache */
+void checkslab(void)
+{
+    struct KmemCache* cache;
+
+    for (cache = cache_list; cache != NULL; cache = cache->next)
+    {
+        printk("%s: %u/%u objs of %uB active, %u slabs of %uK, %u allocs, %u frees\r\n", cache->name, cache->active_objs,
+            cache->slab_count * cache->objs_per_slab, cache->obj_size, cache->slab_count, (uint32_t)(ORDER_SIZE(cache->order) >> 10),
+            cache->alloc_count, cache->free_count);
+    }
+}
+
+void init_slab(void)
+{
+    setup_cache(&cache_cache, "kmem_cache", sizeof(struct KmemCache), NULL);
+    for (int i = 0; i < KMALLOC_CACHES; i++)
+    {
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], 1 << (i + KMALLOC_MIN_SHIFT), NULL);
+        ASSERT(kmalloc_caches[i] != NULL);
+    }
+    //checkslab();
+}
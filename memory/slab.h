@@ -0,0 +1,75 @@
+/**
+    Frostbyte kernel and operating system
+    Copyright (C) 2023  Amol Dhamale <amoldhamale1105@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef void (*KMEM_CTOR)(void* obj);
+
+struct KmemCache;
+
+/* Slab header stored in the first bytes of every slab. The objects follow it in the same buddy block */
+struct Slab
+{
+    struct Slab* next;
+    struct Slab* prev;
+    struct KmemCache* cache;
+    void* free_list; /* Free objects of this slab linked through their first 8 bytes */
+    uint32_t in_use;
+};
+
+struct KmemCache
+{
+    char name[16];
+    uint32_t obj_size; /* Object size rounded up to the object alignment */
+    uint32_t objs_per_slab;
+    int order; /* Buddy block order of every slab of this cache */
+    KMEM_CTOR ctor; /* Optional constructor run on every object handed out by the cache */
+    /* Sentinels of circular doubly linked slab lists */
+    struct Slab partial;
+    struct Slab full;
+    struct Slab empty;
+    struct KmemCache* next; /* Link in the global list of caches */
+    /* Statistics */
+    uint32_t slab_count;
+    uint32_t active_objs;
+    uint32_t alloc_count;
+    uint32_t free_count;
+};
+
+#define SLAB_OBJ_ALIGN      8
+#define MAX_SLAB_ORDER      3 /* Slabs are at most 32K */
+#define MIN_OBJS_PER_SLAB   8 /* A slab grows in order until it holds at least this many objects */
+#define KMALLOC_MIN_SHIFT   4 /* Smallest kmalloc cache holds 16 byte objects */
+#define KMALLOC_MAX_SHIFT   11 /* Largest kmalloc cache holds 2K objects, larger requests are served by the buddy allocator */
+#define KMALLOC_CACHES      (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+
+void init_slab(void);
+struct KmemCache* kmem_cache_create(const char* name, uint32_t size, KMEM_CTOR ctor);
+void* kmem_cache_alloc(struct KmemCache* cache);
+void kmem_cache_free(struct KmemCache* cache, void* obj);
+void kmem_cache_shrink(struct KmemCache* cache);
+void* kmalloc(uint32_t size);
+void kmfree(void* addr);
+void checkslab(void);
+
+#endif
@@ -17,57 +17,206 @@
  */
 
 #include "process.h"
+#include "workqueue.h"
 #include <memory/memory.h>
+#include <memory/slab.h>
 #include <debug/debug.h>
 #include <stddef.h>
 #include <io/print.h>
 
-static struct Process process_table[PROC_TABLE_SIZE];
-static int pid_num = 1;
+/* Table of live processes, grown on demand. Slots are NULL until a process object is allocated from the process cache */
+static struct Process** process_table;
+static uint32_t table_size = 0;
+static uint32_t* free_slots; /* Stack of the free slots of the process table */
+static uint32_t nr_free_slots = 0;
+static struct KmemCache* process_cache;
+static struct Process* pid_hash[PID_HASH_SIZE];
+static uint64_t pid_map[PID_MAX / 64]; /* Bit n is set while PID n is taken, i.e. until the process is released after its exit */
+static int last_pid = 0; /* PID handed out last. The search for a free PID resumes after it */
 static struct ProcessControl pc;
 static bool shutdown = false;
+static uint64_t boost_tick = SCHED_BOOST_TICKS; /* Tick at which the next priority boost is due */
+static uint64_t load_tick = LOAD_FREQ; /* Tick at which the next load average sample is due */
+static uint32_t loadavg[3]; /* 1, 5 and 15 minute load averages in fixed point */
+static const uint32_t load_exp[3] = {1884, 2014, 2037}; /* LOAD_FIXED_1/exp(5s/1min), LOAD_FIXED_1/exp(5s/5min), LOAD_FIXED_1/exp(5s/15min) */
+static struct Process** sleep_heap; /* Min-heap of the processes in a timed sleep ordered by wake time, rooted at 1. Sized with the process table */
+static uint32_t sleepers = 0;
 
-static struct Process* find_unused_slot(void)
+#define PID_BUCKET(pid) ((uint32_t)(pid) & (PID_HASH_SIZE - 1))
+
+static void hash_pid(struct Process* process)
+{
+    struct Process** bucket = &pid_hash[PID_BUCKET(process->pid)];
+
+    process->pid_next = *bucket;
+    *bucket = process;
+}
+
+static void unhash_pid(struct Process* process)
 {
-    struct Process* process = NULL;
-    /* The first process slot is reserved only for the idle process */
-    for (int i = 1; i < PROC_TABLE_SIZE; i++)
+    struct Process** link = &pid_hash[PID_BUCKET(process->pid)];
+
+    while (*link != NULL)
     {
-        if (process_table[i].state == UNUSED){
-            process = process_table + i;
-            memset(process, 0, sizeof(struct Process));
+        if (*link == process){
+            *link = process->pid_next;
             break;
         }
+        link = &(*link)->pid_next;
     }
-    
+    process->pid_next = NULL;
+}
+
+static void unlink_child(struct Process* process)
+{
+    if (process->parent == NULL)
+        return;
+    if (process->sibling_prev != NULL)
+        process->sibling_prev->sibling_next = process->sibling_next;
+    else
+        process->parent->children = process->sibling_next;
+    if (process->sibling_next != NULL)
+        process->sibling_next->sibling_prev = process->sibling_prev;
+    process->parent = process->sibling_next = process->sibling_prev = NULL;
+}
+
+/* Assign a new parent process ID and move the process to the children list of that parent */
+static void set_parent(struct Process* process, int ppid)
+{
+    struct Process* parent;
+
+    unlink_child(process);
+    process->ppid = ppid;
+    parent = get_process(ppid);
+    if (parent == NULL)
+        return;
+    process->parent = parent;
+    process->sibling_next = parent->children;
+    if (parent->children != NULL)
+        parent->children->sibling_prev = process;
+    parent->children = process;
+}
+
+/* Double the process table along with the free slot stack and the sleeper heap, which may hold every process at once
+   @return false if the table is at its limit or memory ran out, true otherwise */
+static bool grow_process_table(void)
+{
+    uint32_t size = (table_size == 0) ? PROC_TABLE_INIT_SIZE : table_size * 2;
+    struct Process** table;
+    struct Process** heap;
+    uint32_t* slots;
+
+    if (size > PID_MAX)
+        return false;
+    table = kmalloc(size * sizeof(struct Process*));
+    heap = kmalloc((size + 1) * sizeof(struct Process*));
+    slots = kmalloc(size * sizeof(uint32_t));
+    if (table == NULL || heap == NULL || slots == NULL){
+        kmfree(table);
+        kmfree(heap);
+        kmfree(slots);
+        return false;
+    }
+    memset(table, 0, size * sizeof(struct Process*));
+    if (table_size != 0){
+        memcpy(table, process_table, table_size * sizeof(struct Process*));
+        memcpy(heap, sleep_heap, (sleepers + 1) * sizeof(struct Process*));
+        memcpy(slots, free_slots, nr_free_slots * sizeof(uint32_t));
+    }
+    kmfree(process_table);
+    kmfree(sleep_heap);
+    kmfree(free_slots);
+    process_table = table;
+    sleep_heap = heap;
+    free_slots = slots;
+    /* Push the new slots highest first so that the lowest are handed out first. The first slot is reserved for the idle process */
+    for (uint32_t i = size - 1; i >= (table_size == 0 ? 1 : table_size); i--)
+        free_slots[nr_free_slots++] = i;
+    table_size = size;
+
+    return true;
+}
+
+/* Take a free slot of the process table, growing the table if none is left, and fill it with a new process object
+   @return the process, which is handed out zeroed by the cache constructor, or NULL if there is no memory for it */
+static struct Process* find_unused_slot(void)
+{
+    struct Process* process;
+
+    if (nr_free_slots == 0 && !grow_process_table())
+        return NULL;
+    process = kmem_cache_alloc(process_cache);
+    if (process == NULL)
+        return NULL;
+    process->slot = free_slots[--nr_free_slots];
+    process_table[process->slot] = process;
+
     return process;
 }
 
-static struct Process* alloc_new_process(void)
+/* Take the next free PID after the one handed out last, wrapping around at PID_MAX. A PID stays taken until its process is
+   released, hence a PID waited on or signalled by number never refers to a newer process while the old one is still around
+   @return the PID, or -1 if every PID is taken */
+static int alloc_pid(void)
+{
+    int pid = (last_pid + 1 < PID_MAX) ? last_pid + 1 : 1;
+    uint32_t word = pid / 64;
+    uint64_t free = ~pid_map[word] & (~0UL << (pid % 64));
+
+    /* The word the search started in is visited again after the wrap for the PIDs below the start */
+    for (int n = 0; n <= PID_MAX / 64; n++)
+    {
+        if (free != 0){
+            pid = word * 64 + __builtin_ctzl(free);
+            pid_map[word] |= (1UL << (pid % 64));
+            last_pid = pid;
+            return pid;
+        }
+        word = (word + 1) % (PID_MAX / 64);
+        free = ~pid_map[word];
+    }
+
+    return -1;
+}
+
+static void free_pid(int pid)
+{
+    pid_map[pid / 64] &= ~(1UL << (pid % 64));
+}
+
+/* Allocate a process along with its kernel stack. Unless it is to share the address space of its parent, it also gets its own
+   translation tables and an empty environment */
+static struct Process* alloc_new_process(bool own_vm)
 {
     struct Process* process;
+    int pid = alloc_pid();
 
+    if (pid < 0)
+        return NULL;
     process = find_unused_slot();
-    if (process == NULL)
+    if (process == NULL){
+        free_pid(pid);
         return NULL;
+    }
 
     memset(process->name, 0, sizeof(process->name));
-    /* Allocate memory for the process page table, kernel stack and heap */
-    process->page_map = (uint64_t)kalloc();
-    ASSERT(process->page_map != 0);
-    memset((void*)process->page_map, 0, PAGE_TABLE_SIZE);
-    /* The kernel stack will reside at the top of the allocated page. Heap starts after the stack */
-    process->stack = (uint64_t)(process->page_map + PAGE_SIZE - STACK_SIZE);
-    process->heap = (uint64_t)(process->page_map + PAGE_SIZE - STACK_SIZE - HEAP_SIZE);
-    /* Allocate extended memory for holding the process environment, heap and shared memory */
-    process->env = (uint64_t)kalloc();
-    ASSERT(process->env != 0);
-    memset((void*)process->env, 0, sizeof(struct Map));
+    /* Allocate a separate block for the kernel stack */
+    process->stack = (uint64_t)kalloc_order(get_order(STACK_SIZE));
+    ASSERT(process->stack != 0);
+    if (own_vm){
+        /* Allocate a frame for the global directory table of the process. Lower level tables are allocated as pages get mapped */
+        process->page_map = (uint64_t)kzalloc_order(0);
+        ASSERT(process->page_map != 0);
+        /* Allocate extended memory for holding the process environment */
+        process->env = (uint64_t)kalloc_order(get_order(sizeof(struct Map)));
+        ASSERT(process->env != 0);
+        memset((void*)process->env, 0, sizeof(struct Map));
+    }
 
     process->state = INIT;
     process->event = NONE;
-    /* Assign a PID and increment the global PID counter. Processes may share the same table slot but never the same PID number */
-    process->pid = pid_num++;
+    process->pid = pid;
+    hash_pid(process);
     /* Get the context frame which is located at the top of the kernel stack */
     process->reg_context = (struct ContextFrame*)(process->stack + STACK_SIZE - sizeof(struct ContextFrame));
     /* Set the stack pointer to 12 GPRs below the context frame where the userspace context is saved */
@@ -81,26 +230,125 @@ static struct Process* alloc_new_process(void)
     process->reg_context->elr = USERSPACE_BASE;
     /* In current version of the kernel, all regions (text, stack, data) of a process are expected to lie in the same 2M page  
        Hence, set the stack pointer to the top of the page from where it can grow downwards */
-    process->reg_context->sp0 = USERSPACE_BASE + PAGE_SIZE;
+    process->reg_context->sp0 = USERSPACE_BASE + USERSPACE_SIZE;
     /* Set pstate mode field to 0 (EL0) and DAIF bits to 0 which means no masking of interrupts i.e. interrupts enabled */
     process->reg_context->spsr = 0;
 
     return process;
 }
 
-static void init_idle_process(void)
+static void free_process_mem(struct Process* process)
+{
+    /* A vfork child which exited before calling exec has no address space of its own */
+    if (process->page_map != 0){
+        release_asid(process);
+        free_uvm(process->page_map);
+    }
+    kfree(process->stack);
+    kmfree((void*)process->args);
+}
+
+/* Release a zombie process along with the files it left open and return its process object to the cache */
+static void release_process(struct Process* process)
+{
+    /* A vfork child still running on the address space of the zombie takes it over */
+    for (uint32_t i = 1; i < table_size; i++)
+    {
+        if (process_table[i] != NULL && process_table[i]->vm_lender == process){
+            process_table[i]->vm_lender = NULL;
+            process_table[i]->asid = process->asid;
+            process->page_map = 0;
+            process->env = 0;
+            process->asid = 0;
+            break;
+        }
+    }
+    free_process_mem(process);
+    /* Close all files left open by the zombie */
+    for(int i = 0; i < MAX_OPEN_FILES; i++)
+        close_file(process, i);
+    /* Drop the zombie from the PID index and the family tree. Children left behind no longer have a parent to link to */
+    unhash_pid(process);
+    free_pid(process->pid);
+    unlink_child(process);
+    while (process->children != NULL)
+        unlink_child(process->children);
+    /* Mark process table slot free so that a new process can utilize it */
+    process_table[process->slot] = NULL;
+    free_slots[nr_free_slots++] = process->slot;
+    /* Freed process objects remain in the cache and hence stale references observe the unused state */
+    process->state = UNUSED;
+    process->daemon = false;
+    kmem_cache_free(process_cache, process);
+}
+
+/* Release the zombies handed over by defer_release */
+static void release_zombies(struct Work* work)
 {
     struct Process* process;
-    /* Allocate the first slot in the process table */
-    process = process_table;
+
+    while ((process = (struct Process*)pop_front(&pc.reaped)) != NULL)
+        release_process(process);
+}
+
+static struct Work release_work = INIT_WORK(release_zombies);
+
+/* Leave the release of a zombie, i.e. freeing its memory and closing its files, to the worker thread. It is dropped from the
+   PID index and the family tree right away, hence it can no longer be found, waited on or signalled just as if it was released */
+static void defer_release(struct Process* process)
+{
+    remove(&pc.zombies, (struct Node*)process);
+    unhash_pid(process);
+    unlink_child(process);
+    process->ppid = 0;
+    process->reaped = true;
+    push_back(&pc.reaped, (struct Node*)process);
+    schedule_work(&release_work);
+}
+
+/* Objects handed out by the process cache start off zeroed */
+static void zero_process(void* obj)
+{
+    memset(obj, 0, sizeof(struct Process));
+}
+
+static struct RunQueue* this_rq(void)
+{
+    return &pc.run_que[cpu_id()];
+}
+
+static struct RunQueue* proc_rq(struct Process* process)
+{
+    return &pc.run_que[process->cpu];
+}
+
+/* Set up the idle process of the calling core, which becomes its current process
+   The idle process of the boot core occupies the first slot in the process table. Those of the other cores are kept off the table */
+void init_idle_process(void)
+{
+    struct RunQueue* rq = this_rq();
+    struct Process* process;
+
+    process = kmem_cache_alloc(process_cache);
     ASSERT(process != NULL);
+    if (cpu_id() == 0)
+        process_table[0] = process;
 
     process->state = RUNNING;
     process->pid = 0;
     process->daemon = true;
-    /* Since this is the first process of the system, page map is initialized with current val of TTBR0 register */
-    process->page_map = TO_VIRT(read_gdt());
-    pc.curr_process = process;
+    process->cpu = cpu_id();
+    process->acct_stamp = read_counter();
+    /* The idle process runs in kernel space only. Its empty tables keep a core off the user tables while it idles */
+    process->page_map = (uint64_t)kzalloc_order(0);
+    ASSERT(process->page_map != 0);
+    rq->idle_process = process;
+    rq->curr_process = process;
+    /* Drop the identity mapping of the boot tables the core was brought up with */
+    if (cpu_id() != 0){
+        switch_vm(process);
+        flush_tlb();
+    }
 }
 
 static void init_user_process(void)
@@ -108,7 +356,7 @@ static void init_user_process(void)
     struct Process* process;
     const char* filename = "INIT.BIN";
     printk("Starting /%s as init process\n", filename);
-    process = alloc_new_process();
+    process = alloc_new_process(true);
     ASSERT(process != NULL);
 
     ASSERT(setup_uvm(process, (char*)filename));
@@ -118,22 +366,532 @@ static void init_user_process(void)
     process->daemon = true;
     /* Initialize signal handlers for the init process */
     init_handlers(process);
-    push_back(&pc.ready_que, (struct Node*)process);
+    enqueue_ready(process);
     printk("Started init process.\n");
 }
 
+/* Background work of the idle process before it waits for the next interrupt
+   @return 1 if a system shutdown is pending, 0 otherwise */
+int idle_work(void)
+{
+    bool halt;
+
+    /* The idle loop runs outside the kernel lock. The pool takes it for the allocator by itself */
+    fill_zero_pool();
+    disable_irq();
+    lock_kernel();
+    halt = shutdown;
+    unlock_kernel();
+    enable_irq();
+
+    return halt;
+}
+
 void init_process(void)
 {
-    pc.ready_que.head = pc.ready_que.tail = NULL;
+    process_cache = kmem_cache_create("process", sizeof(struct Process), zero_process);
+    ASSERT(process_cache != NULL);
+    ASSERT(grow_process_table());
+    /* PID 0 belongs to the idle processes for good */
+    pid_map[0] = 1;
+    for (int cpu = 0; cpu < NCPU; cpu++)
+    {
+#ifdef SCHED_CFS
+        pc.run_que[cpu].ready_tree.root = pc.run_que[cpu].ready_tree.leftmost = NULL;
+        pc.run_que[cpu].min_vruntime = 0;
+        pc.run_que[cpu].load = 0;
+#else
+        for (int level = 0; level < SCHED_LEVELS; level++)
+            pc.run_que[cpu].ready_que[level].head = pc.run_que[cpu].ready_que[level].tail = NULL;
+        pc.run_que[cpu].ready_map = 0;
+#endif
+        for (int prio = 0; prio <= RT_PRIO_MAX; prio++)
+            pc.run_que[cpu].rt_que[prio].head = pc.run_que[cpu].rt_que[prio].tail = NULL;
+        pc.run_que[cpu].rt_map = 0;
+        pc.run_que[cpu].nr_rt = 0;
+        pc.run_que[cpu].nr_ready = 0;
+        pc.run_que[cpu].need_resched = false;
+    }
+    for (int i = 0; i < WAIT_HASH_SIZE; i++)
+        pc.wait_que[i].head = pc.wait_que[i].tail = NULL;
+    pc.waiters = 0;
     init_idle_process();
     init_def_handlers(&pc);
     init_user_process();
+    /* Kernel threads come after init which has to be PID 1 */
+    init_workqueues();
+}
+
+#ifdef SCHED_CFS
+/* Weight per niceness from NICE_MIN to NICE_MAX. The processor is shared in proportion to the weights of the runnable processes */
+static const uint32_t nice_weights[NICE_MAX - NICE_MIN + 1] = {
+    88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+    9548, 7620, 6100, 4904, 3906, 3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423, 335, 272, 215, 172, 137,
+    110, 87, 70, 56, 45, 36, 29, 23, 18, 15
+};
+
+static uint32_t nice_weight(int nice)
+{
+    return nice_weights[nice - NICE_MIN];
+}
+
+/* Virtual runtimes only ever grow and are compared by their difference, so that they may wrap around */
+static bool vruntime_less(const struct RbNode* a, const struct RbNode* b)
+{
+    return (int64_t)(container_of(a, struct Process, run_node)->vruntime - container_of(b, struct Process, run_node)->vruntime) < 0;
+}
+
+static uint64_t max_vruntime(uint64_t a, uint64_t b)
+{
+    return (int64_t)(a - b) > 0 ? a : b;
+}
+
+static void norm_add(struct RunQueue* rq, struct Process* process)
+{
+    rb_insert(&rq->ready_tree, &process->run_node, vruntime_less);
+    rq->load += nice_weight(process->nice);
+}
+
+static void norm_del(struct RunQueue* rq, struct Process* process)
+{
+    rb_erase(&rq->ready_tree, &process->run_node);
+    rq->load -= nice_weight(process->nice);
+}
+
+/* @return the ready process with the least virtual runtime. Only valid while the tree is not empty */
+static struct Process* norm_first(struct RunQueue* rq)
+{
+    return container_of(rb_first(&rq->ready_tree), struct Process, run_node);
+}
+
+/* @return the ready process with the most virtual runtime, i.e. the one that can wait the longest */
+static struct Process* norm_last(struct RunQueue* rq)
+{
+    return container_of(rb_last(&rq->ready_tree), struct Process, run_node);
+}
+
+static bool norm_queued(struct Process* process)
+{
+    return process->run_node.tree == &proc_rq(process)->ready_tree;
+}
+
+/* Advance the floor of the virtual runtimes to the least of them on the core. It never goes back */
+static void update_min_vruntime(struct RunQueue* rq)
+{
+    struct Process* curr = rq->curr_process;
+    uint64_t vruntime = rq->min_vruntime;
+    bool running = (curr->pid != 0 && curr->policy == SCHED_OTHER && !norm_queued(curr));
+    uint64_t first;
+
+    if (running)
+        vruntime = curr->vruntime;
+    if (rq->ready_tree.leftmost != NULL){
+        first = norm_first(rq)->vruntime;
+        vruntime = (running && (int64_t)(vruntime - first) < 0) ? vruntime : first;
+    }
+    rq->min_vruntime = max_vruntime(rq->min_vruntime, vruntime);
+}
+
+/* Add the run time since the last update to the virtual runtime of the running process, scaled by its weight
+   A process already put back on the ready tree is left alone, its key must not change while it is linked. Real-time processes have none */
+static void update_curr(struct RunQueue* rq)
+{
+    struct Process* curr = rq->curr_process;
+    uint64_t now = read_counter();
+    uint64_t delta = now - curr->exec_start;
+
+    if (curr->pid == 0 || curr->policy != SCHED_OTHER || norm_queued(curr))
+        return;
+    curr->exec_start = now;
+    curr->vruntime += delta * NICE_0_WEIGHT / nice_weight(curr->nice);
+    update_min_vruntime(rq);
+}
+
+/* Place a process joining a run queue. Its virtual runtime is carried over relative to the floor of the queue it comes from
+   A new child comes from the queue of its parent's core with the virtual runtime of its parent, hence a child forked on a busy
+   core lands level with its parent wherever it is queued. A process that slept keeps no more than half a period of credit,
+   so that it cannot monopolize the core after a long sleep */
+static void place_process(struct RunQueue* rq, struct Process* process, struct RunQueue* from)
+{
+    process->vruntime = process->vruntime - from->min_vruntime + rq->min_vruntime;
+    process->vruntime = max_vruntime(process->vruntime, rq->min_vruntime - ns_to_count(SCHED_LATENCY_NS / 2));
+}
+
+/* Time slice of the running process. The period is split among the time shared ready processes in proportion to their weights */
+static uint64_t time_slice(struct RunQueue* rq, struct Process* process)
+{
+    uint64_t period = ns_to_count(SCHED_LATENCY_NS);
+    uint32_t nr = rq->nr_ready - rq->nr_rt + 1;
+    uint32_t weight = nice_weight(process->nice);
+
+    if (nr > SCHED_LATENCY_NS / SCHED_MIN_GRANULARITY_NS)
+        period = nr * ns_to_count(SCHED_MIN_GRANULARITY_NS);
+
+    return period * weight / (rq->load + weight);
+}
+
+/* Whether the running process has to give way to the leftmost ready process, which is too far behind it in virtual runtime */
+static bool norm_preempt(struct RunQueue* rq, struct Process* process)
+{
+    return (int64_t)(process->vruntime - norm_first(rq)->vruntime) > (int64_t)ns_to_count(SCHED_WAKEUP_GRANULARITY_NS);
+}
+#else
+/* Highest level with a ready process. Only valid while ready_map is not zero */
+static int ready_level(struct RunQueue* rq)
+{
+    return __builtin_ctz(rq->ready_map);
+}
+
+static void norm_add(struct RunQueue* rq, struct Process* process)
+{
+    push_back(&rq->ready_que[process->priority], (struct Node*)process);
+    rq->ready_map |= (1 << process->priority);
+}
+
+static void norm_del(struct RunQueue* rq, struct Process* process)
+{
+    struct List* que = &rq->ready_que[process->priority];
+
+    remove(que, (struct Node*)process);
+    if (empty(que))
+        rq->ready_map &= ~(1 << process->priority);
+}
+
+/* @return the process at the head of the highest non-empty level. Only valid while ready_map is not zero */
+static struct Process* norm_first(struct RunQueue* rq)
+{
+    return (struct Process*)front(&rq->ready_que[ready_level(rq)]);
+}
+
+/* @return the last process of the lowest non-empty level, i.e. the one which would wait the longest */
+static struct Process* norm_last(struct RunQueue* rq)
+{
+    return (struct Process*)back(&rq->ready_que[31 - __builtin_clz(rq->ready_map)]);
+}
+
+static bool norm_queued(struct Process* process)
+{
+    return process->list == &proc_rq(process)->ready_que[process->priority];
+}
+
+/* Whether a ready process of a higher level outranks the running process */
+static bool norm_preempt(struct RunQueue* rq, struct Process* process)
+{
+    return ready_level(rq) < process->priority;
+}
+#endif
+
+/* The real-time classes sit on top of the time shared policy. A ready real-time process always runs ahead of the time shared ones
+   and of real-time ones of a lower priority. SCHED_FIFO processes run until they block or are outranked, SCHED_RR ones take turns
+   with the others of their priority every SCHED_RR_TIMESLICE_NS */
+static bool rt_policy(const struct Process* process)
+{
+    return process->policy != SCHED_OTHER;
+}
+
+/* Real-time priority a process competes at, 0 for the time shared processes */
+static int rt_rank(const struct Process* process)
+{
+    return rt_policy(process) ? process->rt_priority : 0;
+}
+
+/* Highest real-time priority with a ready process, 0 if there is none */
+static int rt_top(const struct RunQueue* rq)
+{
+    return rq->rt_map != 0 ? 31 - __builtin_clz(rq->rt_map) : 0;
 }
 
+static void rq_add(struct RunQueue* rq, struct Process* process)
+{
+    if (rt_policy(process)){
+        push_back(&rq->rt_que[process->rt_priority], (struct Node*)process);
+        rq->rt_map |= (1U << process->rt_priority);
+        rq->nr_rt++;
+    }
+    else
+        norm_add(rq, process);
+    rq->nr_ready++;
+}
+
+static void rq_del(struct RunQueue* rq, struct Process* process)
+{
+    struct List* que = &rq->rt_que[process->rt_priority];
+
+    if (rt_policy(process)){
+        remove(que, (struct Node*)process);
+        if (empty(que))
+            rq->rt_map &= ~(1U << process->rt_priority);
+        rq->nr_rt--;
+    }
+    else
+        norm_del(rq, process);
+    rq->nr_ready--;
+}
+
+/* @return the process to run next, the first one of the highest real-time priority if any. Only valid while the queue is not empty */
+static struct Process* rq_first(struct RunQueue* rq)
+{
+    if (rq->rt_map != 0)
+        return (struct Process*)front(&rq->rt_que[rt_top(rq)]);
+
+    return norm_first(rq);
+}
+
+/* @return the process which can wait the longest, a time shared one if any */
+static struct Process* rq_last(struct RunQueue* rq)
+{
+    if (rq->nr_ready != rq->nr_rt)
+        return norm_last(rq);
+
+    return (struct Process*)back(&rq->rt_que[__builtin_ctz(rq->rt_map)]);
+}
+
+bool on_ready_que(struct Process* process)
+{
+    if (rt_policy(process))
+        return process->list == &proc_rq(process)->rt_que[process->rt_priority];
+
+    return norm_queued(process);
+}
+
+/* Whether the running process has to give way to a ready one. A real-time process only gives way to a higher real-time priority */
+static bool preempt_curr(struct RunQueue* rq, struct Process* process)
+{
+    if (rt_top(rq) > rt_rank(process))
+        return true;
+    if (rt_policy(process) || rq->nr_ready == rq->nr_rt)
+        return false;
+
+    return norm_preempt(rq, process);
+}
+
+/* Have a core reconsider its running process. Another core is interrupted, this one switches on its way out of the exception */
+static void resched_cpu(int cpu)
+{
+    if (cpu == cpu_id())
+        pc.run_que[cpu].need_resched = true;
+    else
+        send_ipi(cpu);
+}
+
+bool need_resched(void)
+{
+    return this_rq()->need_resched;
+}
+
+/* Whether a core is up and has nothing but its idle process to run */
+static bool cpu_idle(int cpu)
+{
+    struct RunQueue* rq = &pc.run_que[cpu];
+
+    return rq->idle_process != NULL && rq->curr_process == rq->idle_process && rq->nr_ready == 0;
+}
+
+/* Real-time priority a core is busy at, i.e. the highest of its running and ready processes */
+static int cpu_rank(int cpu)
+{
+    struct RunQueue* rq = &pc.run_que[cpu];
+    int rank = rt_rank(rq->curr_process);
+
+    return rt_top(rq) > rank ? rt_top(rq) : rank;
+}
+
+/* Pick the core to queue a process on. It stays on the core it last ran on unless that one is busy and another one idles
+   With no core idling, a real-time process goes to the core busy at the lowest real-time priority */
+static int select_cpu(struct Process* process)
+{
+    int target = process->cpu;
+
+    if (cpu_idle(process->cpu))
+        return process->cpu;
+    for (int cpu = 0; cpu < NCPU; cpu++)
+    {
+        if (cpu_idle(cpu))
+            return cpu;
+    }
+    if (rt_policy(process)){
+        for (int cpu = 0; cpu < NCPU; cpu++)
+        {
+            if (pc.run_que[cpu].idle_process != NULL && cpu_rank(cpu) < cpu_rank(target))
+                target = cpu;
+        }
+    }
+
+    return target;
+}
+
+/* Place a process on the ready queue of a core
+   The current process of this core is put back on the local queue. Any other process may go to an idle core, which is kicked
+   A real-time process outranking the running process of its core has it preempted at once rather than at the next tick */
+void enqueue_ready(struct Process* process)
+{
+    struct RunQueue* rq;
+    bool kick;
+#ifdef SCHED_CFS
+    struct RunQueue* from = proc_rq(process);
+#endif
+
+    if (process != this_rq()->curr_process){
+        process->cpu = select_cpu(process);
+#ifdef SCHED_CFS
+        place_process(proc_rq(process), process, from);
+#endif
+    }
+    rq = proc_rq(process);
+    kick = (process != rq->curr_process && (rq->curr_process == rq->idle_process || rt_rank(process) > rt_rank(rq->curr_process)));
+    process->ready_since = read_counter();
+    rq_add(rq, process);
+    if (kick)
+        resched_cpu(process->cpu);
+}
+
+/* Take a process off the ready queue of its core
+   @return true if the process was queued, false otherwise */
+bool dequeue_ready(struct Process* process)
+{
+    if (!on_ready_que(process))
+        return false;
+    rq_del(proc_rq(process), process);
+
+    return true;
+}
+
+/* Pull a ready process over from the core with the most of them. The one which can wait the longest there is taken
+   @return true if a process was moved to the run queue of this core */
+static bool steal_process(struct RunQueue* rq)
+{
+    struct RunQueue* busiest = NULL;
+    struct Process* process;
+
+    for (int cpu = 0; cpu < NCPU; cpu++)
+    {
+        if (&pc.run_que[cpu] != rq && pc.run_que[cpu].nr_ready != 0 && (busiest == NULL || pc.run_que[cpu].nr_ready > busiest->nr_ready))
+            busiest = &pc.run_que[cpu];
+    }
+    if (busiest == NULL)
+        return false;
+    process = rq_last(busiest);
+    rq_del(busiest, process);
+    process->cpu = rq - pc.run_que;
+#ifdef SCHED_CFS
+    if (!rt_policy(process))
+        process->vruntime = process->vruntime - busiest->min_vruntime + rq->min_vruntime;
+#endif
+    rq_add(rq, process);
+
+    return true;
+}
+
+static void heap_place(struct Process* process, uint32_t pos)
+{
+    sleep_heap[pos] = process;
+    process->heap_pos = pos;
+}
+
+/* Restore the heap order around a position whose wake time has changed */
+static void heap_fix(uint32_t pos)
+{
+    struct Process* process = sleep_heap[pos];
+    uint32_t child;
+
+    while (pos > 1 && sleep_heap[pos/2]->wake_time > process->wake_time)
+    {
+        heap_place(sleep_heap[pos/2], pos);
+        pos /= 2;
+    }
+    while ((child = pos*2) <= sleepers)
+    {
+        if (child < sleepers && sleep_heap[child+1]->wake_time < sleep_heap[child]->wake_time)
+            child++;
+        if (sleep_heap[child]->wake_time >= process->wake_time)
+            break;
+        heap_place(sleep_heap[child], pos);
+        pos = child;
+    }
+    heap_place(process, pos);
+}
+
+static void heap_insert(struct Process* process)
+{
+    ASSERT(sleepers < table_size);
+    heap_place(process, ++sleepers);
+    heap_fix(sleepers);
+    /* Core 0 times the sleepers. Have it rearm its timer if the new sleeper is due before the one it was armed for */
+    if (process->heap_pos == 1 && cpu_id() != 0)
+        send_ipi(0);
+}
+
+/* Fill the hole left by a removed process with the last one on the heap */
+static void heap_remove(struct Process* process)
+{
+    uint32_t pos = process->heap_pos;
+    struct Process* last = sleep_heap[sleepers--];
+
+    process->heap_pos = 0;
+    if (last != process){
+        heap_place(last, pos);
+        heap_fix(pos);
+    }
+}
+
+/* Append a process to the wait queue of the event it is sleeping on. The event must not change while it is queued
+   Timed sleepers are also placed on the sleeper heap so that the earliest of them is known without a scan */
+void enqueue_wait(struct Process* process)
+{
+    push_back(&pc.wait_que[WAIT_BUCKET(process->event)], (struct Node*)process);
+    /* Idle kernel threads do not hold off a shutdown */
+    if (!process->kthread)
+        pc.waiters++;
+    if (process->event == SLEEP_SYSCALL)
+        heap_insert(process);
+}
+
+/* Take a process off the wait queue of its event
+   @return true if the process was queued, false otherwise */
+bool dequeue_wait(struct Process* process)
+{
+    if (remove(&pc.wait_que[WAIT_BUCKET(process->event)], (struct Node*)process) == NULL)
+        return false;
+    if (!process->kthread)
+        pc.waiters--;
+    if (process->heap_pos != 0)
+        heap_remove(process);
+
+    return true;
+}
+
+#ifndef SCHED_CFS
+/* Move every process to the highest scheduler level with a fresh time quantum. Ready processes keep their relative order */
+static void boost_priorities(void)
+{
+    struct RunQueue* rq;
+    struct Node* node;
+
+    for (int cpu = 0; cpu < NCPU; cpu++)
+    {
+        rq = &pc.run_que[cpu];
+        for (int level = 1; level < SCHED_LEVELS; level++)
+        {
+            while ((node = pop_front(&rq->ready_que[level])) != NULL)
+                push_back(&rq->ready_que[0], node);
+        }
+        rq->ready_map = empty(&rq->ready_que[0]) ? 0 : 1;
+    }
+    for (int i = 1; i < table_size; i++)
+    {
+        if (process_table[i] != NULL){
+            process_table[i]->priority = 0;
+            process_table[i]->run_ticks = 0;
+        }
+    }
+}
+#endif
+
 static void switch_process(struct Process* existing, struct Process* new)
 {
     /* Switch the page tables to point to the new user process memory */
-    switch_vm(new->page_map);
+    switch_vm(new);
     /* Swap the currently running process with the new process chosen by the scheduler */
     swap(&existing->sp, new->sp);
     /* The new process in previous context will resume execution here once swapped in unless it's the first time it's running
@@ -149,11 +907,97 @@ static void switch_process(struct Process* existing, struct Process* new)
     }
 }
 
+/* Close the accounting of the outgoing process and start that of the incoming one. A process leaving the processor in the READY state
+   was preempted, in any other state it gave the processor up. The incoming process is charged for its time on the ready queue */
+static void account_switch(struct Process* old_process, struct Process* new_process)
+{
+    uint64_t now = read_counter();
+    uint64_t wait;
+
+    if (new_process->pid != 0){
+        wait = now - new_process->ready_since;
+        new_process->wait_time += wait;
+        if (wait > new_process->max_wait)
+            new_process->max_wait = wait;
+    }
+    if (old_process == new_process)
+        return;
+    old_process->stime += now - old_process->acct_stamp;
+    new_process->acct_stamp = now;
+    if (old_process->state == READY)
+        old_process->nivcsw++;
+    else
+        old_process->nvcsw++;
+}
+
+/* Charge the time since the last accounting point to the current process. It is called on kernel entry, where the time before
+   goes to the mode the exception was taken from, and on the way out of the handler, where the time before was spent in the kernel */
+void account_time(bool user)
+{
+    struct Process* process = this_rq()->curr_process;
+    uint64_t now = read_counter();
+
+    if (user)
+        process->utime += now - process->acct_stamp;
+    else
+        process->stime += now - process->acct_stamp;
+    process->acct_stamp = now;
+}
+
+/* Processes running or ready to run on all cores */
+static uint32_t nr_running(void)
+{
+    uint32_t count = 0;
+
+    for (int cpu = 0; cpu < NCPU; cpu++)
+    {
+        count += pc.run_que[cpu].nr_ready;
+        if (pc.run_que[cpu].curr_process != NULL && pc.run_que[cpu].curr_process->pid != 0)
+            count++;
+    }
+
+    return count;
+}
+
+/* Fold the number of runnable processes into the exponentially decaying load averages once per LOAD_FREQ ticks
+   With the dynamic tick, samples missed while no timer interrupt came in are made up for with the current count */
+static void update_load(uint64_t now)
+{
+    uint32_t active;
+
+    if (now < load_tick)
+        return;
+    active = nr_running() * LOAD_FIXED_1;
+    while (now >= load_tick)
+    {
+        for (int i = 0; i < 3; i++)
+            loadavg[i] = (loadavg[i] * load_exp[i] + active * (LOAD_FIXED_1 - load_exp[i])) >> LOAD_FSHIFT;
+        load_tick += LOAD_FREQ;
+    }
+}
+
+/* Whether every core idles with nothing to run, which is when the system may halt */
+static bool all_cpus_idle(void)
+{
+    for (int cpu = 0; cpu < NCPU; cpu++)
+    {
+        if (pc.run_que[cpu].idle_process != NULL && !cpu_idle(cpu))
+            return false;
+    }
+
+    return true;
+}
+
 static void schedule(void)
 {
-    struct Process* old_process = pc.curr_process;
+    struct RunQueue* rq = this_rq();
+    struct Process* old_process = rq->curr_process;
     struct Process* new_process = NULL;
 
+#ifdef SCHED_CFS
+    /* Charge the outgoing process for its run up to here */
+    update_curr(rq);
+#endif
     /* Check for pending signals on suspended processes */
     struct Process* sjob = (struct Process*)front(&pc.suspended);
     struct Process* next_sjob = NULL;
@@ -164,63 +1008,169 @@ static void schedule(void)
         check_pending_signals(sjob);
         sjob = next_sjob;
     }
-    /* While returning to user mode from kernel mode, check for any pending signals on the process about to be scheduled */
-    while (!empty(&pc.ready_que))
+    /* Pick the process at the head of the ready queue. The local queue running dry, work is taken over from another core
+       While returning to user mode from kernel mode, check for any pending signals on the process about to be scheduled */
+    while (rq->nr_ready != 0 || steal_process(rq))
     {
-        new_process = (struct Process*)front(&pc.ready_que);
-        if (process_table->signals & (1 << SIGTERM))
+        new_process = rq_first(rq);
+        if ((process_table[0]->signals & (1 << SIGTERM)) && !new_process->kthread)
             printk("Stopping process %s (%d)\n", new_process->name, new_process->pid);
         check_pending_signals(new_process);
-        /* If the checked process is still present at the head of the queue, proceed to scheduling it */
-        if ((uint64_t)new_process == (uint64_t)front(&pc.ready_que)){
-            pop_front(&pc.ready_que);
+        /* If the checked process is still the next in line, proceed to scheduling it */
+        if (rq->nr_ready != 0 && new_process == rq_first(rq)){
+            dequeue_ready(new_process);
             break;
         }
         /* Reset the pointer to accomodate the next process at the head of the queue */
         new_process = NULL;
     }
-    /* If no other process is ready to run and the queue is empty, schedule the idle process (with below exception)
-       Halt the system if the ready and wait queues are both empty and a termination signal has been issued to the idle process */
-    if (empty(&pc.ready_que) && !new_process){
-        if (empty(&pc.wait_list)){
-            if (process_table->signals & (1 << SIGTERM)){
+    /* If no other process is ready to run and the queues are empty, schedule the idle process (with below exception)
+       Halt the system if no core has anything to run, the wait queues are empty and a termination signal has been issued to the idle process */
+    if (!new_process){
+        new_process = rq->idle_process;
+        rq->curr_process = new_process;
+        if (pc.waiters == 0 && !shutdown && all_cpus_idle()){
+            if (process_table[0]->signals & (1 << SIGTERM)){
                 shutdown = true;
                 printk("Stopping kernel ...\n");
+                /* The other idle cores notice the shutdown on their way back into the idle loop */
+                for (int cpu = 0; cpu < NCPU; cpu++)
+                {
+                    if (cpu != cpu_id() && pc.run_que[cpu].idle_process != NULL)
+                        send_ipi(cpu);
+                }
             }
         }
-        new_process = process_table;
     }
 
     new_process->state = RUNNING;
-    pc.curr_process = new_process;
+    new_process->cpu = cpu_id();
+    rq->curr_process = new_process;
+    rq->need_resched = false;
+    new_process->slice_start = read_counter();
+#ifdef SCHED_CFS
+    new_process->exec_start = new_process->slice_start;
+#else
+    rq->charge_tick = get_ticks();
+#endif
+    account_switch(old_process, new_process);
     /* Set scheduled process as current foreground process if it identifies itself as one and no other process is assuming one */
     if (!new_process->daemon && pc.fg_process == NULL)
         pc.fg_process = new_process;
+#ifndef RPI4
+    /* The new process may resume straight into user mode, hence arm the timer for it here */
+    program_timer();
+#endif
 
     switch_process(old_process, new_process);
 }
 
+#ifdef SCHED_CFS
+/* Charge the running process for its run since the last call
+   @return true if it has used up its time slice */
+static bool norm_charge(struct RunQueue* rq, struct Process* process, uint64_t now)
+{
+    update_curr(rq);
+
+    return process->pid != 0 && read_counter() - process->slice_start >= time_slice(rq, process);
+}
+#else
+/* Charge the running process for the ticks since the last call and demote it a level once it has run for the time quantum of its level
+   Every process is periodically lifted back to the highest level so that demoted CPU bound processes are not starved
+   @return true if the process has used up its quantum */
+static bool norm_charge(struct RunQueue* rq, struct Process* process, uint64_t now)
+{
+    bool expired = false;
+
+    if (now >= boost_tick){
+        boost_tick = now + SCHED_BOOST_TICKS;
+        boost_priorities();
+    }
+    if (process->pid != 0)
+        process->run_ticks += now - rq->charge_tick;
+    rq->charge_tick = now;
+    if (process->pid != 0 && process->run_ticks >= SCHED_QUANTUM(process->priority)){
+        expired = true;
+        process->run_ticks = 0;
+        if (process->priority < SCHED_LEVELS-1)
+            process->priority++;
+    }
+
+    return expired;
+}
+#endif
+
+/* A SCHED_FIFO process has no time slice. A SCHED_RR one has used it up after SCHED_RR_TIMESLICE_NS
+   @return true if the running process has used up its time slice */
+static bool charge_curr(struct RunQueue* rq, struct Process* process, uint64_t now)
+{
+    if (!rt_policy(process))
+        return norm_charge(rq, process, now);
+
+    return process->policy == SCHED_RR && read_counter() - process->slice_start >= ns_to_count(SCHED_RR_TIMESLICE_NS);
+}
+
+/* Called on every timer interrupt. The running process keeps the processor until it has used up its time slice, unless a ready
+   process outranks it (a higher real-time priority, a higher level under the multilevel feedback queue, a virtual runtime far enough
+   behind under the fair scheduler). It is also called on the way out of any exception which queued a process outranking the running one
+   With the dynamic tick, several ticks may have gone by since the last call */
 void trigger_scheduler(void)
 {
-    struct Process* process;
+    struct RunQueue* rq = this_rq();
+    struct Process* process = rq->curr_process;
+    uint64_t now = get_ticks();
+    bool expired;
+    bool signalled;
+
+    update_load(now);
+    expired = charge_curr(rq, process, now);
+    /* A foreground pause issued from another core while the process was running here takes effect now */
+    if (process->state == SLEEP){
+        enqueue_wait(process);
+        schedule();
+        return;
+    }
 
-    /* Return and continue running the same process if the ready queue is empty */
-    if (empty(&pc.ready_que))
+    /* An idle core takes over work queued on a busy one */
+    if (process->pid == 0 && rq->nr_ready == 0)
+        steal_process(rq);
+    /* Signals sent from another core to the running process are acted on by passing it through the scheduler */
+    signalled = (process->pid != 0 && process->signals != 0);
+    /* Return and continue running the same process if no other process is ready or none of them outranks it */
+    if (rq->nr_ready == 0 && !signalled)
+        return;
+    if (process->pid != 0 && !expired && !signalled && !preempt_curr(rq, process))
         return;
     /* The current process state needs to be changed from running to ready */
-    process = pc.curr_process;
     process->state = READY;
 
     /* The idle process (PID 0) is run by default and is also not appended to the ready queue */
     if (process->pid != 0)
-        push_back(&pc.ready_que, (struct Node*)process);
+        enqueue_ready(process);
+    /* A real-time process preempted before the end of its time slice resumes ahead of the others of its priority */
+    if (rt_policy(process) && !expired){
+        remove(&rq->rt_que[process->rt_priority], (struct Node*)process);
+        push_front(&rq->rt_que[process->rt_priority], (struct Node*)process);
+    }
 
     schedule();
 }
 
 struct Process *get_curr_process(void)
 {
-    return pc.curr_process;
+    return this_rq()->curr_process;
+}
+
+/* @return the process running on a core, NULL if the core is not up yet */
+struct Process* get_cpu_process(int cpu)
+{
+    return pc.run_que[cpu].curr_process;
+}
+
+/* Whether a process is the current process of a core other than this one. Such a process is out of reach until that core enters the kernel */
+bool running_elsewhere(struct Process* process)
+{
+    return process->cpu != cpu_id() && pc.run_que[process->cpu].curr_process == process;
 }
 
 struct Process *get_fg_process(void)
@@ -234,30 +1184,25 @@ struct Process *get_fg_process(void)
 
 struct Process *get_process(int pid)
 {
-    struct Process* process = NULL;
+    struct Process* process = pid_hash[PID_BUCKET(pid)];
+
+    while (process != NULL && process->pid != pid)
+        process = process->pid_next;
 
-    for (int i = 1; i < PROC_TABLE_SIZE; i++)
-    {
-        if (process_table[i].state != UNUSED && process_table[i].pid == pid){
-            process = &process_table[i];
-            break;
-        }
-    }
     return process;
 }
 
 struct Process* find_job(int job_spec, int ppid)
 {
-    struct Process* process = NULL;
-    if (job_spec <= 0)
+    struct Process* parent = get_process(ppid);
+    struct Process* process;
+    if (job_spec <= 0 || parent == NULL)
         return NULL;
     
-    for(int i = 1; i < PROC_TABLE_SIZE; i++)
+    for (process = parent->children; process != NULL; process = process->sibling_next)
     {
-        if (process_table[i].state != UNUSED && process_table[i].ppid == ppid && process_table[i].job_spec == job_spec){
-            process = &process_table[i];
+        if (process->job_spec == job_spec)
             break;
-        }
     }
     return process;
 }
@@ -269,16 +1214,17 @@ void move_to_fore(struct Process* process)
     
     process->daemon = false;
     if (process->state != STOPPED){ /* Stopped processes won't resume without a continue signal */
+        /* Dequeue before touching the event since the wait queue is looked up by it
+           A foreground pause which has not yet taken the process off another core is called off instead */
+        if (process->state == SLEEP)
+            process->state = dequeue_wait(process) ? READY : RUNNING;
         /* Convert input event since the process is now moving to the foreground */
         if (process->event == DAEMON_INPUT)
             process->event = KEYBOARD_INPUT;
-        if (process->state == SLEEP){
-            remove(&pc.wait_list, (struct Node*)process);
-            process->state = READY;
-        }
         pc.fg_process = process;
-        if (!contains(&pc.ready_que, (struct Node*)process))
-            push_back(&pc.ready_que, (struct Node*)process);
+        /* A process running on a core stays there */
+        if (process->state == READY && !on_ready_que(process))
+            enqueue_ready(process);
     }
 }
 
@@ -302,32 +1248,29 @@ int get_status(int pid)
 int get_proc_data(int pid, int *ppid, int *state, int* job_spec, char *name, char* args_buf)
 {
     int args_size = 0;
+    struct Process* process = get_process(pid);
 
-    for (int i = 1; i < PROC_TABLE_SIZE; i++)
-    {
-        if (process_table[i].state != UNUSED && process_table[i].pid == pid){
-            if (ppid != NULL)
-                *ppid = process_table[i].ppid;
-            if (state != NULL)
-                *state = process_table[i].state;
-            if (job_spec != NULL)
-                *job_spec = process_table[i].job_spec;
-            if (name != NULL)
-                memcpy(name, process_table[i].name, strlen(process_table[i].name));
-            /* Retrieve the program arguments from the args member */
-            char* arg = (char*)process_table[i].args;
-            int arg_len;
-            for(int j = 0; j < process_table[i].argc; j++)
-            {
-                arg_len = strlen(arg+args_size);
-                if (args_buf != NULL){
-                    memcpy(args_buf+args_size, arg+args_size, arg_len);
-                    *(args_buf+args_size+arg_len) = 0;
-                }
-                args_size += (arg_len+1);
-            }
-            break;
+    if (process == NULL)
+        return args_size;
+    if (ppid != NULL)
+        *ppid = process->ppid;
+    if (state != NULL)
+        *state = process->state;
+    if (job_spec != NULL)
+        *job_spec = process->job_spec;
+    if (name != NULL)
+        memcpy(name, process->name, strlen(process->name));
+    /* Retrieve the program arguments from the args member */
+    char* arg = (char*)process->args;
+    int arg_len;
+    for(int j = 0; j < process->argc; j++)
+    {
+        arg_len = strlen(arg+args_size);
+        if (args_buf != NULL){
+            memcpy(args_buf+args_size, arg+args_size, arg_len);
+            *(args_buf+args_size+arg_len) = 0;
         }
+        args_size += (arg_len+1);
     }
 
     return args_size;
@@ -336,45 +1279,207 @@ int get_proc_data(int pid, int *ppid, int *state, int* job_spec, char *name, cha
 int get_active_pids(struct Process* process, int* pid_list, int all)
 {
     int count = 0;
+
+    if (!all){ /* Get PIDs of current session i.e. the process and its children */
+        if (pid_list != NULL)
+            pid_list[count] = process->pid;
+        count++;
+        for (struct Process* child = process->children; child != NULL; child = child->sibling_next)
+        {
+            if (pid_list != NULL)
+                pid_list[count] = child->pid;
+            count++;
+        }
+        return count;
+    }
     /* Omit the idle process which occupies the first slot in the process table
        The idle process should be always runnning in kernel context until the system is shutdown */
-    for(int i = 1; i < PROC_TABLE_SIZE; i++)
+    for(int i = 1; i < table_size; i++)
     {
-        if (process_table[i].state != UNUSED){
-            if (all){
-                if (pid_list != NULL)
-                    pid_list[count] = process_table[i].pid;
-                count++;
-            }
-            else{ /* Get PIDs of current session */
-                if ((process_table[i].ppid == process->pid) || (process_table[i].pid == process->pid)){
-                    if (pid_list != NULL)
-                        pid_list[count] = process_table[i].pid;
-                    count++;
-                }
-            }
+        if (process_table[i] != NULL && !process_table[i]->reaped){
+            if (pid_list != NULL)
+                pid_list[count] = process_table[i]->pid;
+            count++;
         }
     }
 
     return count;
 }
 
+/* Time a process has spent in user and kernel mode up to now. A process running on another core has not been charged since that core
+   last entered the kernel. It is in user mode, or idling in case of an idle process. A kernel thread is always in the kernel */
+static void proc_times(struct Process* process, uint64_t* utime, uint64_t* stime)
+{
+    uint64_t pending = running_elsewhere(process) ? read_counter() - process->acct_stamp : 0;
+    bool kernel = (process->pid == 0 || process->kthread);
+
+    *utime = process->utime + (kernel ? 0 : pending);
+    *stime = process->stime + (kernel ? pending : 0);
+}
+
+int get_proc_stat(int pid, struct ProcStat* stat)
+{
+    struct Process* process = get_process(pid);
+    uint64_t utime, stime;
+
+    if (process == NULL || stat == NULL)
+        return -1;
+    proc_times(process, &utime, &stime);
+    stat->utime = count_to_ns(utime);
+    stat->stime = count_to_ns(stime);
+    stat->wait_time = count_to_ns(process->wait_time);
+    stat->max_wait = count_to_ns(process->max_wait);
+    stat->nvcsw = process->nvcsw;
+    stat->nivcsw = process->nivcsw;
+    stat->cpu = process->cpu;
+    stat->priority = process->priority;
+    stat->nice = process->nice;
+    stat->policy = process->policy;
+    stat->rt_priority = process->rt_priority;
+
+    return 0;
+}
+
+/* A process may change how itself and its descendants are scheduled, nothing else. Kernel threads are left alone */
+static bool may_sched(struct Process* caller, struct Process* process)
+{
+    if (process->kthread)
+        return false;
+    for (; process != NULL; process = process->parent)
+    {
+        if (process == caller)
+            return true;
+    }
+    return false;
+}
+
+/* Set the niceness of a process, the calling one for PID 0. Values out of range are clamped
+   The weight of a ready process counts towards the load of its run queue, which follows the change
+   @return 0 on success, -1 if there is no such process or the caller is not allowed to make the change */
+int set_nice(int pid, int nice)
+{
+    struct Process* caller = get_curr_process();
+    struct Process* process = (pid == 0) ? caller : get_process(pid);
+
+    if (process == NULL || process->state == KILLED || !may_sched(caller, process))
+        return -1;
+    if (nice < NICE_MIN)
+        nice = NICE_MIN;
+    else if (nice > NICE_MAX)
+        nice = NICE_MAX;
+#ifdef SCHED_CFS
+    /* The weight of a real-time process does not count towards the load */
+    if (!rt_policy(process) && on_ready_que(process))
+        proc_rq(process)->load = proc_rq(process)->load - nice_weight(process->nice) + nice_weight(nice);
+    /* A running process is charged at its old weight up to the change */
+    else if (get_cpu_process(process->cpu) == process)
+        update_curr(proc_rq(process));
+#endif
+    process->nice = nice;
+
+    return 0;
+}
+
+/* Move a process, the calling one for PID 0, to another scheduling class. Real-time classes take a priority from RT_PRIO_MIN
+   to RT_PRIO_MAX, SCHED_OTHER takes 0. A process may change the class of itself and its descendants
+   A ready process is requeued for the new class and its core reconsiders what it runs
+   @return 0 on success, -1 if there is no such process, the policy or priority is invalid or the caller is not allowed to make the change */
+int set_scheduler(int pid, int policy, int rt_priority)
+{
+    struct Process* caller = get_curr_process();
+    struct Process* process = (pid == 0) ? caller : get_process(pid);
+    struct RunQueue* rq;
+    bool queued, running;
+
+    if (process == NULL || process->state == KILLED || !may_sched(caller, process))
+        return -1;
+    if (policy == SCHED_OTHER){
+        if (rt_priority != 0)
+            return -1;
+    }
+    else if ((policy != SCHED_FIFO && policy != SCHED_RR) || rt_priority < RT_PRIO_MIN || rt_priority > RT_PRIO_MAX)
+        return -1;
+    rq = proc_rq(process);
+    running = (rq->curr_process == process);
+    queued = dequeue_ready(process);
+#ifdef SCHED_CFS
+    if (running)
+        update_curr(rq);
+    /* The virtual runtime went stale while the process ran as real-time. It rejoins at the floor of its core */
+    if (rt_policy(process) && policy == SCHED_OTHER)
+        process->vruntime = rq->min_vruntime;
+#endif
+    process->policy = policy;
+    process->rt_priority = rt_priority;
+    if (running){
+        process->slice_start = read_counter();
+#ifdef SCHED_CFS
+        process->exec_start = process->slice_start;
+#else
+        rq->charge_tick = get_ticks();
+#endif
+    }
+    if (queued)
+        rq_add(rq, process);
+    if (queued || running)
+        resched_cpu(process->cpu);
+
+    return 0;
+}
+
+/* @return the scheduling class of a process, the calling one for PID 0, or -1 if there is no such process */
+int get_scheduler(int pid)
+{
+    struct Process* process = (pid == 0) ? get_curr_process() : get_process(pid);
+
+    if (process == NULL || process->state == KILLED)
+        return -1;
+
+    return process->policy;
+}
+
+void get_sys_stat(struct SysStat* stat)
+{
+    uint64_t idle_time = 0;
+    uint64_t utime, stime;
+
+    for (int cpu = 0; cpu < NCPU; cpu++)
+    {
+        if (pc.run_que[cpu].idle_process != NULL){
+            proc_times(pc.run_que[cpu].idle_process, &utime, &stime);
+            idle_time += stime;
+        }
+    }
+    update_load(get_ticks());
+    stat->uptime = count_to_ns(read_counter());
+    stat->idle_time = count_to_ns(idle_time);
+    memcpy(stat->loadavg, loadavg, sizeof(loadavg));
+    stat->nr_running = nr_running();
+    stat->nr_procs = get_active_pids(NULL, NULL, 1);
+    stat->ncpu = 0;
+    for (int cpu = 0; cpu < NCPU; cpu++)
+    {
+        if (pc.run_que[cpu].idle_process != NULL)
+            stat->ncpu++;
+    }
+}
+
 void switch_parent(int curr_ppid, int new_ppid, bool transfer_jobs)
 {
     struct Process* parent = get_process(new_ppid);
-    if (!parent || parent->state == KILLED)
+    struct Process* curr_parent = get_process(curr_ppid);
+    struct Process* child;
+    if (!parent || parent->state == KILLED || !curr_parent)
         return;
     
-    for(int i = 1; i < PROC_TABLE_SIZE; i++)
-    {
-        /* Reassign parent for all children which have current parent with curr_ppid */
-        if (process_table[i].state != UNUSED && process_table[i].ppid == curr_ppid){
-            process_table[i].ppid = new_ppid;
-            /* Handover running jobs to new parent */
-            if (transfer_jobs && process_table[i].job_spec && process_table[i].state != STOPPED){
-                parent->jobs++;
-                process_table[i].job_spec = parent->jobs;
-            }
+    /* Reassign parent for all children which have current parent with curr_ppid */
+    while ((child = curr_parent->children) != NULL)
+    {
+        set_parent(child, new_ppid);
+        /* Handover running jobs to new parent */
+        if (transfer_jobs && child->job_spec && child->state != STOPPED){
+            parent->jobs++;
+            child->job_spec = parent->jobs;
         }
     }
 }
@@ -383,36 +1488,123 @@ void sleep(int event)
 {
     struct Process* process;
 
-    process = pc.curr_process;
+    process = this_rq()->curr_process;
     process->state = SLEEP;
     /* Save the reason of wait which can used in wake_up to selectively wake up processes based on occurred events */
     process->event = event;
 
-    /* Enqueue the process on the wait list so that it cannot be rescheduled until woken up and placed on ready queue */
-    push_back(&pc.wait_list, (struct Node*)process);
+    /* Enqueue the process on the wait queue of its event so that it cannot be rescheduled until woken up and placed on ready queue */
+    enqueue_wait(process);
     /* Call the scheduler to replace the current process (which just slept) with other process on the ready queue */
     schedule();
 }
 
 void wake_up(int event)
 {
-    struct Process* process, *next_node = NULL;
-    
-    /* remove first process waiting on event from the wait list */
-    process = (struct Process*)remove_evt(&pc.wait_list, (struct Node**)&next_node, event);
-    /* Place it on the ready queue and check if any other processes waiting on the same event
-       If they're sleeping, remove from wait list and place them on the ready queue as well */
+    struct List* que = &pc.wait_que[WAIT_BUCKET(event)];
+    struct Process* process = (struct Process*)front(que);
+    struct Process* next_process;
+
+    /* Only the queue of this event is walked. Place every process waiting on the event on the ready queue
+       Processes waiting on another event which hashed to the same bucket are skipped */
     while (process != NULL)
     {
-        if (!contains(&pc.ready_que, (struct Node*)process)){
+        next_process = (struct Process*)process->next;
+        if (process->event == event){
+            dequeue_wait(process);
+            /* Processes waking up from user input are interactive. Put them at the highest level with a fresh quantum */
+            if (event == KEYBOARD_INPUT){
+                process->priority = 0;
+                process->run_ticks = 0;
+            }
             process->event = NONE;
             process->state = READY;
-            push_back(&pc.ready_que, (struct Node*)process);
+            enqueue_ready(process);
+        }
+        process = next_process;
+    }
+    /* A process marked to sleep on the event while running on another core has not queued itself yet. It simply keeps running */
+    for (int cpu = 0; cpu < NCPU; cpu++)
+    {
+        process = pc.run_que[cpu].curr_process;
+        if (cpu != cpu_id() && process != NULL && process->state == SLEEP && process->event == event){
+            process->event = NONE;
+            process->state = RUNNING;
         }
-        process = (struct Process*)remove_evt(&pc.wait_list, (struct Node**)&next_node, event);
     }
 }
 
+/* Wake up the timed sleepers due by the given system count. Each of them is woken up exactly once, the others are not touched */
+void wake_sleepers(uint64_t now)
+{
+    struct Process* process;
+
+    while (sleepers != 0 && sleep_heap[1]->wake_time <= now)
+    {
+        process = sleep_heap[1];
+        dequeue_wait(process);
+        /* Processes waking up from a sleep are interactive. Put them at the highest level with a fresh quantum */
+        process->priority = 0;
+        process->run_ticks = 0;
+        process->event = NONE;
+        process->state = READY;
+        enqueue_ready(process);
+    }
+}
+
+/* @return the system count at which the earliest timed sleeper is due, UINT64_MAX if there is none */
+uint64_t next_wake_time(void)
+{
+    return sleepers != 0 ? sleep_heap[1]->wake_time : UINT64_MAX;
+}
+
+#ifdef TICKLESS
+/* Earliest tick at which the scheduler has to run, which is the end of the running process' time slice
+   The slice only matters while another process is ready to take over. Sleeper expiries are accounted for by the caller
+   @return the deadline tick, or UINT64_MAX if the running process may keep the processor until some other interrupt */
+uint64_t next_deadline(uint64_t now)
+{
+    struct RunQueue* rq = this_rq();
+    struct Process* process = rq->curr_process;
+    uint64_t tick = ns_to_count(NSEC_PER_SEC / 100);
+    uint64_t slice, ran;
+
+    if (rq->nr_ready == 0)
+        return UINT64_MAX;
+    /* The idle process and outranked processes give way at the next tick boundary */
+    if (process->pid == 0 || preempt_curr(rq, process))
+        return now + 1;
+    if (rt_policy(process)){
+        /* A FIFO process is only ever preempted by a wakeup, which reschedules right away */
+        if (process->policy == SCHED_FIFO)
+            return UINT64_MAX;
+        slice = ns_to_count(SCHED_RR_TIMESLICE_NS);
+    }
+    else{
+#ifdef SCHED_CFS
+        slice = time_slice(rq, process);
+#else
+        if (process->run_ticks >= SCHED_QUANTUM(process->priority))
+            return now;
+
+        return now + SCHED_QUANTUM(process->priority) - process->run_ticks;
+#endif
+    }
+    ran = read_counter() - process->slice_start;
+    if (ran >= slice)
+        return now;
+
+    return now + (slice - ran + tick - 1) / tick;
+}
+#endif
+
+/* Give the address space borrowed by a vfork child back to its parent and let the parent run again */
+static void return_vm(struct Process* process)
+{
+    process->vm_lender = NULL;
+    wake_up(VFORK_DONE);
+}
+
 void exit(struct Process* process, int status, bool sig_handler_req)
 {
     if (process == NULL || process->state == UNUSED || process->state == KILLED)
@@ -428,7 +1620,7 @@ void exit(struct Process* process, int status, bool sig_handler_req)
         parent->status = process->status;
     }
     else /* Orphan process. Make init a foster parent */
-        process->ppid = 1;
+        set_parent(process, 1);
     /* Terminate stopped jobs and recursively kill their children */
     struct Process* sjob = (struct Process*)front(&pc.suspended);
     struct Process* next_sjob;
@@ -444,6 +1636,13 @@ void exit(struct Process* process, int status, bool sig_handler_req)
         }
         sjob = next_sjob;
     }
+    /* A vfork child which did not get to call exec leaves the address space to its parent */
+    if (process->vm_lender != NULL){
+        process->page_map = 0;
+        process->env = 0;
+        process->asid = 0;
+        return_vm(process);
+    }
     /* Handover potential orphan children if any to the init process */
     switch_parent(process->pid, 1, true);
     /* Abdicate status as current system foreground process if it was one */
@@ -469,17 +1668,17 @@ int wait(int pid, int* wstatus, int options)
     int wpid;
     if (pid == 0 || pid < -1)
         return -1;
-    pc.curr_process->wpid = pid;
+    this_rq()->curr_process->wpid = pid;
     
     while (1)
     {
         wpid = pid;
         bool has_child = false;
         /* Acknowledge a stopped process */
-        if (pc.curr_process->wpid > 1){
-            struct Process* process = get_process(pc.curr_process->wpid);
+        if (this_rq()->curr_process->wpid > 1){
+            struct Process* process = get_process(this_rq()->curr_process->wpid);
             if (process && process->state == STOPPED && contains(&pc.suspended, (struct Node*)process)){
-                pc.curr_process->wpid = pid;
+                this_rq()->curr_process->wpid = pid;
                 if (options & WUNTRACED){ /* Return with PID of stopped process */
                     wpid = process->pid;
                     if (wstatus != NULL)
@@ -489,34 +1688,32 @@ int wait(int pid, int* wstatus, int options)
             }
         }
         /* Make init a foster parent of abandoned zombies */
-        if (pc.curr_process->pid == 1){
+        if (this_rq()->curr_process->pid == 1){
             struct Process* process = (struct Process*)front(&pc.zombies);
             while (process != NULL)
             {
                 if (process->ppid != 1){
                     struct Process* parent = get_process(process->ppid);
                     if (!parent || (parent->wpid >= 0 && process->pid != parent->wpid))
-                        process->ppid = 1;
+                        set_parent(process, 1);
                 }
                 process = (struct Process*)process->next;
             }
         }
         /* Search for first available zombie child */
         if (pid == -1){
-            for(int i = 1; i < PROC_TABLE_SIZE; i++)
+            for (struct Process* child = this_rq()->curr_process->children; child != NULL; child = child->sibling_next)
             {
-                if (process_table[i].state != UNUSED && process_table[i].ppid == pc.curr_process->pid){
-                    has_child = true;
-                    if (contains(&pc.zombies, (struct Node*)&process_table[i])){
-                        wpid = process_table[i].pid;
-                        break;
-                    }
+                has_child = true;
+                if (contains(&pc.zombies, (struct Node*)child)){
+                    wpid = child->pid;
+                    break;
                 }
             }
         }
         else{ /* Verify if the PID the current process is waiting for is a valid child process */
             struct Process* process = get_process(wpid);
-            if (process != NULL && process->ppid == pc.curr_process->pid)
+            if (process != NULL && process->ppid == this_rq()->curr_process->pid)
                 has_child = true;
         }
         /* If the current process doesn't have any children, there's no need to wait */
@@ -528,24 +1725,10 @@ int wait(int pid, int* wstatus, int options)
             /* There's a chance some process or handler already cleaned up this zombie */
             if (wproc->state != KILLED)
                 break;
-            free_uvm(wproc->page_map);
-            /* Decrement ref counts of all files left open by the zombie */
-            for(int i = 0; i < MAX_OPEN_FILES; i++)
-            {
-                if (wproc->fd_table[i] != NULL){
-                    wproc->fd_table[i]->ref_count--;
-                    wproc->fd_table[i]->inode->ref_count--;
-                    /* Note that we can't release the inode based on only the file entry ref count because other file entries could be pointing to it
-                        Hence the in core inode should be released (entry set to NULL) only if the inode ref count is zero */
-                    if (wproc->fd_table[i]->inode->ref_count == 0)
-                        wproc->fd_table[i]->inode = NULL;
-                }
-            }
-            /* Mark process table slot free so that a new process can utilize it */
-            wproc->state = UNUSED;
             /* Return the wait status to the caller */
             if (wstatus != NULL)
                 *wstatus = wproc->status;
+            defer_release(wproc);
             break;
         }
         if (options & WNOHANG)
@@ -556,73 +1739,146 @@ int wait(int pid, int* wstatus, int options)
     return wpid;
 }
 
+/* Hand the child the parent's open files and scheduling parameters and link it into the family of the parent */
+static void inherit_process(struct Process* process, struct Process* parent)
+{
+    set_parent(process, parent->pid);
+    /* The child is queued on the core of its parent unless another one idles, rather than piling up on core 0 */
+    process->cpu = parent->cpu;
+    /* The child starts out with the scheduling class, the niceness and the share of the processor used so far of its parent */
+    process->nice = parent->nice;
+    process->vruntime = parent->vruntime;
+    process->policy = parent->policy;
+    process->rt_priority = parent->rt_priority;
+    /* Replicate the parent file descriptor table for the child since it shares all open files with the parent 
+       Increment the global file table entry ref count of open files. The inode ref count will be incremented as usual */
+    memcpy(process->fd_table, parent->fd_table, MAX_OPEN_FILES * sizeof(struct FileEntry*));
+    for(int i = 0; i < MAX_OPEN_FILES; i++)
+    {
+        if (process->fd_table[i] != NULL)
+            file_get(process->fd_table[i]);
+    }
+}
+
+/* Yield current system foreground process status if held by the process, which will allow a child to claim it if required */
+static void yield_fg(struct Process* process)
+{
+    if (pc.fg_process != NULL){
+        if (process->pid == pc.fg_process->pid)
+            pc.fg_process = NULL;
+    }
+}
+
+/* Environment in use by a process. One which switched to the environment of its parent uses that of the parent */
+static uint64_t proc_env(struct Process* process)
+{
+    if (process->env == 0){
+        process = get_process(process->ppid);
+        if (process == NULL)
+            return 0;
+    }
+    return process->env;
+}
+
 int fork(void)
 {
+    struct Process* parent = this_rq()->curr_process;
     struct Process* process;
 
     /* Allocate a new child process */
-    process = alloc_new_process();
+    process = alloc_new_process(true);
     if (process == NULL)
         return -1;
     
     /* Copy the process name and set parent process ID */
-    memcpy(process->name, pc.curr_process->name, sizeof(process->name));
-    process->ppid = pc.curr_process->pid;
-    /* Yield current system foreground process status if holding one, which will allow the child to claim it if required */
-    if (pc.fg_process != NULL){
-        if (pc.curr_process->pid == pc.fg_process->pid)
-            pc.fg_process = NULL;
-    }
-    /* Copy the text, data, stack and other regions of the parent to the child process' memory */
-    char currproc_filename[MAX_FILENAME_BYTES+MAX_EXTNAME_BYTES+2];
-    memcpy(currproc_filename, pc.curr_process->name, strlen(pc.curr_process->name));
-    memcpy(currproc_filename+strlen(pc.curr_process->name), ".BIN", 5);
-    if (!copy_uvm(process, pc.curr_process->page_map, currproc_filename))
+    memcpy(process->name, parent->name, sizeof(process->name));
+    inherit_process(process, parent);
+    /* Share the text, data, stack and other pages of the parent with the child process. They are copied on first write
+       Pages of the program image which the parent has not touched yet are paged in independently by the child */
+    process->image_cluster = parent->image_cluster;
+    process->image_size = parent->image_size;
+    process->brk = parent->brk;
+    process->mmap_top = parent->mmap_top;
+    if (!copy_uvm(process, parent)){
+        release_process(process);
         return -1;
-
-    /* Replicate the parent file descriptor table for the child since it shares all open files with the parent 
-       Increment the global file table entry ref count of open files. The inode ref count will be incremented as usual */
-    memcpy(process->fd_table, pc.curr_process->fd_table, MAX_OPEN_FILES * sizeof(struct FileEntry*));
-    for(int i = 0; i < MAX_OPEN_FILES; i++)
-    {
-        if (process->fd_table[i] != NULL){
-            process->fd_table[i]->ref_count++;
-            process->fd_table[i]->inode->ref_count++;
-        }
     }
+    yield_fg(parent);
 
     /* Copy the context frame so that the child process also resumes at the point after the fork call */
-    memcpy(process->reg_context, pc.curr_process->reg_context, sizeof(struct ContextFrame));
+    memcpy(process->reg_context, parent->reg_context, sizeof(struct ContextFrame));
     /* Transfer the parent environment to the child */
-    memcpy((void*)process->env, (void*)pc.curr_process->env, sizeof(struct Map));
+    memcpy((void*)process->env, (void*)parent->env, sizeof(struct Map));
     /* Initialize signal handlers for the child process */
     init_handlers(process);
     /* Set the return value for child process to 0 */
     process->reg_context->x0 = 0;
     process->state = READY;
-    push_back(&pc.ready_que, (struct Node*)process);
+    enqueue_ready(process);
 
     /* The parent process which called fork will be returned the child process PID */
     return process->pid;
 }
 
-int exec(struct Process* process, char* name, const char* args[])
+/* Create a child which runs on the address space of the calling process, stack included, until it calls exec or exits
+   The caller is suspended meanwhile. This spares a child which is only going to load another program the sharing of the
+   parent's pages and the copy-on-write faults the parent would take afterwards */
+int vfork(void)
 {
-    int fd;
-    uint32_t size;
+    struct Process* parent = this_rq()->curr_process;
+    struct Process* process;
+    struct Process* child;
+    int pid;
 
-    fd = open_file(process, name);
-    if (fd == -1)
+    process = alloc_new_process(false);
+    if (process == NULL)
         return -1;
 
-    /* Get the size and count of passed arguments for the new program */
+    memcpy(process->name, parent->name, sizeof(process->name));
+    inherit_process(process, parent);
+    yield_fg(parent);
+    process->image_cluster = parent->image_cluster;
+    process->image_size = parent->image_size;
+    process->brk = parent->brk;
+    process->mmap_top = parent->mmap_top;
+    /* Borrow the translation tables and with them the environment and the ASID of the parent */
+    process->page_map = parent->page_map;
+    process->env = parent->env;
+    process->asid = parent->asid;
+    process->vm_lender = parent;
+
+    /* The child resumes at the point after the vfork call with a return value of 0 */
+    memcpy(process->reg_context, parent->reg_context, sizeof(struct ContextFrame));
+    init_handlers(process);
+    process->reg_context->x0 = 0;
+    process->state = READY;
+    pid = process->pid;
+    enqueue_ready(process);
+
+    /* Stay off the processor until the child gives the address space back since both would run on the same user stack */
+    while ((child = get_process(pid)) != NULL && child->vm_lender == parent)
+        sleep(VFORK_DONE);
+
+    return pid;
+}
+
+/* Copy the program arguments to a kernel buffer which replaces the arguments of the previous program
+   An argument of '&' ends the list and sends the program to the background as a job of its parent
+   @return size of the arguments including their terminators, -1 if the buffer could not be allocated in which case the
+   previous arguments are kept */
+static int load_args(struct Process* process, const char* args[])
+{
     int arg_size = 0;
+    int new_arg_size;
+    int argc = 0;
+    char* arg_buf;
+    char* arg_val_kh;
+
     if (args != NULL){
-        int new_arg_size;
-        while (args[process->argc] != NULL)
+        while (args[argc] != NULL)
         {
-            new_arg_size = strlen(args[process->argc]);
-            if (new_arg_size == 1 && args[process->argc][0] == '&'){
+            new_arg_size = strlen(args[argc]);
+            if (new_arg_size == 1 && args[argc][0] == '&'){
                 struct Process* parent = get_process(process->ppid);
                 if (parent != NULL && parent->state != KILLED){
                     parent->jobs++;
@@ -630,52 +1886,57 @@ int exec(struct Process* process, char* name, const char* args[])
                 }
                 process->daemon = true;
                 /* Yield the foreground status if inherited from the parent during a forking event */
-                if (pc.fg_process != NULL){
-                    if (process->pid == pc.fg_process->pid)
-                        pc.fg_process = NULL;
-                }
+                yield_fg(process);
                 break;
             }
             arg_size += (new_arg_size+1);
-            process->argc++;
+            argc++;
         }
     }
-    /* Copy the program arguments to the kernel heap */
-    process->args = process->heap;
-    char* arg_val_kh = (char*)process->args;
-    int arg_len[process->argc];
-    for(int i = 0; i < process->argc; i++)
+    /* Swap the new buffer in only once it is allocated so that argc always matches the buffer */
+    arg_buf = kmalloc(arg_size);
+    if (arg_size > 0 && arg_buf == NULL)
+        return -1;
+    kmfree((void*)process->args);
+    process->args = (uint64_t)arg_buf;
+    process->argc = argc;
+    arg_val_kh = arg_buf;
+    for(int i = 0; i < argc; i++)
     {
-        arg_len[i] = strlen(args[i]);
-        memcpy(arg_val_kh, (char*)args[i], arg_len[i]);
-        arg_val_kh[arg_len[i]] = 0;
-        arg_val_kh += (arg_len[i]+1);
+        new_arg_size = strlen(args[i]);
+        memcpy(arg_val_kh, (char*)args[i], new_arg_size);
+        arg_val_kh[new_arg_size] = 0;
+        arg_val_kh += (new_arg_size+1);
     }
-    /* Set new name in the process table entry. NOTE Parent process ID would remain the same */
-    int namelen = strlen(name);
-    memset(process->name, 0, sizeof(process->name));
-    memcpy(process->name, name, namelen-(MAX_EXTNAME_BYTES+1));
-    /* In exec call, the regions of the current process are overwritten with the regions of the new process and PID remains the same.
-       Hence there's no need to allocate new memory for the new program */
-    size = get_file_size(process, fd);
-    /* We use the userspace virt address as buffer because memory was previously allocated for the process which called exec */
-    size = read_file(process, fd, (void*)USERSPACE_BASE, size);
-    /* Here if the exec operation fails, only option is to exit because we've cleared the regions of original process */
-    if (size == UINT32_MAX)
-        exit(process, 1, false);
 
-    close_file(process, fd);
-    /* Initialize bss segment */
-    memset((void*)(USERSPACE_BASE+size), 0, DEF_BSS_SIZE);
-    /* Clear any previously set custom handlers and initialize default signal handlers for the new process */
-    memset(process->handlers, 0, sizeof(SIGHANDLER)*TOTAL_SIGNALS);
-    init_handlers(process);
+    return arg_size;
+}
+
+/* Room taken on the user stack by the program name, the arguments and the pointers to them */
+static uint64_t args_stack_size(struct Process* process, int arg_size)
+{
+    int namelen = strlen(process->name) + MAX_EXTNAME_BYTES+1;
+
+    return (process->argc+1)*8 + UPPER_BOUND(arg_size+namelen+1, 8);
+}
+
+/* Reset the register context for the first run of the program and lay out its name and arguments at the top of the user stack
+   The stack is written through stack_top, the address at which the kernel reaches the top of the user stack */
+static void place_args(struct Process* process, char* stack_top, int arg_size)
+{
+    uint64_t delta = (uint64_t)stack_top - (USERSPACE_BASE + USERSPACE_SIZE);
+    int namelen = strlen(process->name) + MAX_EXTNAME_BYTES+1;
+    char* arg_val_kh = (char*)process->args;
+    int64_t* arg_ptr;
+    char* arg_val;
+    int arg_len;
+
     /* Clear the previous process' context frame since we don't return to it */
     memset(process->reg_context, 0, sizeof(struct ContextFrame));
     /* The return address should be set to start of text section of new process i.e. the userspace base address */
     process->reg_context->elr = USERSPACE_BASE;
     /* Set the user program stack pointer to highest page address from where it can grow downwards */
-    process->reg_context->sp0 = USERSPACE_BASE + PAGE_SIZE;
+    process->reg_context->sp0 = USERSPACE_BASE + USERSPACE_SIZE;
     /* Set pstate mode field to 0 (EL0) and DAIF bits to 0 which means no masking of interrupts i.e. interrupts enabled */
     process->reg_context->spsr = 0;
     /* Save arg count in x2 since x0 will be overwritten by the syscall return value when this function returns
@@ -683,115 +1944,245 @@ int exec(struct Process* process, char* name, const char* args[])
     process->reg_context->x2 = process->argc+1;
     /* Make room for program arg pointers and content on the userspace stack */
     process->reg_context->sp0 -= (process->argc+1)*8;
-    int64_t* arg_ptr = (int64_t*)process->reg_context->sp0;
+    arg_ptr = (int64_t*)(process->reg_context->sp0 + delta);
     process->reg_context->sp0 -= UPPER_BOUND(arg_size+namelen+1, 8);
 
-    /* Copy program arguments from the kernel heap to user stack for the process to access */
-    char* arg_val = (char*)process->reg_context->sp0;
-    arg_val_kh = (char*)process->args;
-
+    /* Copy program arguments from the kernel heap to user stack for the process to access. The pointers hold user addresses */
+    arg_val = (char*)(process->reg_context->sp0 + delta);
     memcpy(arg_val, process->name, namelen-(MAX_EXTNAME_BYTES+1));
     memcpy(arg_val+namelen-(MAX_EXTNAME_BYTES+1), ".BIN", MAX_EXTNAME_BYTES+2);
-    *arg_ptr = (int64_t)arg_val;
-    arg_ptr++;
+    arg_ptr[0] = (int64_t)arg_val - delta;
     arg_val += (namelen+1);
-    *(arg_val-1) = 0;
     for(int i = 0; i < process->argc; i++)
     {
-        memcpy(arg_val, arg_val_kh, arg_len[i]);
-        *arg_ptr = (int64_t)arg_val;
-        arg_ptr++;
-        arg_val += (arg_len[i]+1);
-        *(arg_val-1) = 0;
-        arg_val_kh += (arg_len[i]+1);
+        arg_len = strlen(arg_val_kh);
+        memcpy(arg_val, arg_val_kh, arg_len+1);
+        arg_ptr[i+1] = (int64_t)arg_val - delta;
+        arg_val += (arg_len+1);
+        arg_val_kh += (arg_len+1);
     }
 
     /* Save the argument addresses location on the stack to x1 to be used as second argument to main */
-    process->reg_context->x1 = (int64_t)arg_ptr - (process->argc+1)*8;
+    process->reg_context->x1 = (uint64_t)arg_ptr - delta;
+}
+
+int exec(struct Process* process, char* name, const char* args[])
+{
+    int fd;
+    int arg_size;
+    bool loaded;
+
+    fd = open_file(process, name);
+    if (fd == -1)
+        return -1;
+
+    arg_size = load_args(process, args);
+    if (arg_size < 0){
+        close_file(process, fd);
+        return -1;
+    }
+    /* Set new name in the process table entry. NOTE Parent process ID would remain the same */
+    memset(process->name, 0, sizeof(process->name));
+    memcpy(process->name, name, strlen(name)-(MAX_EXTNAME_BYTES+1));
+    /* A vfork child moves to an address space of its own, which leaves the one of its parent untouched. Nothing is read from
+       the borrowed address space past this point, the name and the arguments are in kernel buffers */
+    if (process->vm_lender != NULL){
+        if (!unshare_uvm(process, proc_env(process->vm_lender))){
+            close_file(process, fd);
+            return -1;
+        }
+        return_vm(process);
+        switch_vm(process);
+    }
+    else /* In exec call, the regions of the current process are replaced with the regions of the new process and PID remains the same.
+            Release the pages of the current program and attach the new image. Its pages are read in from the filesystem on first access */
+        clear_uvm(process);
+    loaded = load_uvm(process, fd);
+    close_file(process, fd);
+    /* Here if the exec operation fails, only option is to exit because we've cleared the regions of original process */
+    if (!loaded)
+        exit(process, 1, false);
+
+    /* Clear any previously set custom handlers and initialize default signal handlers for the new process */
+    memset(process->handlers, 0, sizeof(SIGHANDLER)*TOTAL_SIGNALS);
+    init_handlers(process);
+    place_args(process, (char*)(USERSPACE_BASE + USERSPACE_SIZE), arg_size);
 
     return 0;
 }
 
+/* Length of the name in a NAME=VALUE environment string
+   @return -1 if the string is malformed or the name or value do not fit in an environment entry */
+static int env_key_len(const char* str)
+{
+    int keylen;
+
+    for (keylen = 0; str[keylen] != '=' && str[keylen] != 0; keylen++);
+    if (str[keylen] != '=' || keylen == 0 || keylen > MAX_KEY_LEN-1 || strlen(&str[keylen+1]) > MAX_VAL_LEN-1)
+        return -1;
+
+    return keylen;
+}
+
+/* Check the NAME=VALUE strings handed to spawn before any process is set up for them */
+static bool valid_envp(const char* envp[])
+{
+    if (envp == NULL)
+        return true;
+    for(int i = 0; envp[i] != NULL; i++)
+    {
+        if (env_key_len(envp[i]) < 0)
+            return false;
+    }
+
+    return true;
+}
+
+/* Build the environment of a spawned process from the NAME=VALUE strings of envp, or copy the one of its parent if there are none
+   The strings are expected to have passed valid_envp */
+static void spawn_env(struct Process* process, struct Process* parent, const char* envp[])
+{
+    char key[MAX_KEY_LEN];
+    uint64_t env;
+    int keylen;
+
+    if (envp == NULL){
+        env = proc_env(parent);
+        if (env != 0)
+            memcpy((void*)process->env, (void*)env, sizeof(struct Map));
+        return;
+    }
+    for(int i = 0; envp[i] != NULL; i++)
+    {
+        keylen = env_key_len(envp[i]);
+        memcpy(key, (char*)envp[i], keylen);
+        key[keylen] = 0;
+        insert((struct Map*)process->env, key, &envp[i][keylen+1]);
+    }
+}
+
+/* Create a child running the program at path straight away, without a copy of the caller in between. The child shares the
+   open files of the caller and is given the environment strings of envp or a copy of the caller's environment if envp is NULL
+   @return PID of the child, -1 if the program could not be loaded or the arguments do not fit on a page of the user stack */
+int spawn(const char* path, const char* args[], const char* envp[])
+{
+    struct Process* parent = this_rq()->curr_process;
+    struct Process* process;
+    char* stack_page;
+    int arg_size;
+    bool loaded;
+    int fd;
+
+    /* A malformed environment is turned down before the process and its environment block exist */
+    if (!valid_envp(envp))
+        return -1;
+    process = alloc_new_process(true);
+    if (process == NULL)
+        return -1;
+
+    inherit_process(process, parent);
+    init_handlers(process);
+    spawn_env(process, parent, envp);
+    /* Map the environment first, the environment block is freed along with the tables from then on */
+    if (!map_env(process->page_map, process->env))
+        goto fail;
+    fd = open_file(process, (char*)path);
+    if (fd == -1)
+        goto fail;
+    memcpy(process->name, (char*)path, strlen(path)-(MAX_EXTNAME_BYTES+1));
+    arg_size = load_args(process, args);
+    loaded = arg_size >= 0 && load_uvm(process, fd);
+    close_file(process, fd);
+    if (!loaded)
+        goto fail;
+    /* The kernel backs the top page of the user stack of the child to write the arguments there. They are limited to that page */
+    if (args_stack_size(process, arg_size) > FRAME_SIZE || (stack_page = map_stack_top(process)) == NULL)
+        goto fail;
+    place_args(process, stack_page + FRAME_SIZE, arg_size);
+
+    yield_fg(parent);
+    process->state = READY;
+    enqueue_ready(process);
+
+    return process->pid;
+
+fail:
+    release_process(process);
+    return -1;
+}
+
+/* Get a process to act on a signal just sent to it. A sleeping process is woken up and placed on the ready queue
+   One running on another core is interrupted, which passes it through the scheduler where the signal is handled */
+static void notify_process(struct Process* process)
+{
+    if (process->state == SLEEP){
+        if (dequeue_wait(process)){
+            process->state = READY;
+            enqueue_ready(process);
+            return;
+        }
+        /* A foreground pause which has not yet taken the process off its core is called off, as waking the process up would */
+        process->state = RUNNING;
+        process->event = NONE;
+    }
+    if (process->state == RUNNING && process->cpu != cpu_id())
+        send_ipi(process->cpu);
+}
+
 int kill(struct Process* process, int pid, int signal)
 {
     if (signal < 0 || signal > TOTAL_SIGNALS-1)
         return -1;
     if (pid == -1){ /* Send signal to all processes except init process (PID 1) */
-        for(int i = 2; i < PROC_TABLE_SIZE; i++)
+        for(int i = 2; i < table_size; i++)
         {
-            /* The signal is not meant for the process which sent it */
-            if (process_table[i].pid == process->pid)
+            /* The signal is not meant for the process which sent it, nor for the kernel threads */
+            if (process_table[i] == NULL || process_table[i]->pid == process->pid || process_table[i]->kthread)
                 continue;
-            if (!(process_table[i].state == UNUSED || process_table[i].state == KILLED)){
+            if (!(process_table[i]->state == UNUSED || process_table[i]->state == KILLED)){
                 /* Discard pending continue signal on reception of the stop signal and vice versa */
                 if (signal == SIGSTOP || signal == SIGTSTP)
-                    process_table[i].signals &= ~(1 << SIGCONT);
+                    process_table[i]->signals &= ~(1 << SIGCONT);
                 else if (signal == SIGCONT)
-                    process_table[i].signals &= ~((1 << SIGSTOP) | (1 << SIGTSTP));
-                process_table[i].signals |= (1 << signal);
+                    process_table[i]->signals &= ~((1 << SIGSTOP) | (1 << SIGTSTP));
+                process_table[i]->signals |= (1 << signal);
                 /* Wake up sleeping processes to act on the broadcast signal */
-                if (process_table[i].state == SLEEP){
-                    remove(&pc.wait_list, (struct Node*)&process_table[i]);
-                    process_table[i].state = READY;
-                    push_back(&pc.ready_que, (struct Node*)&process_table[i]);
-                }
+                notify_process(process_table[i]);
             }
-            else if (process_table[i].state == KILLED && signal == SIGHUP){
-                if (process_table[i].ppid != 1){ /* Release rogue or unattended zombie not owned by init */
-                    free_uvm(process_table[i].page_map);
-                    /* Decrement ref counts of all files left open by the zombie */
-                    for(int i = 0; i < MAX_OPEN_FILES; i++)
-                    {
-                        if (process_table[i].fd_table[i] != NULL){
-                            process_table[i].fd_table[i]->ref_count--;
-                            process_table[i].fd_table[i]->inode->ref_count--;
-                            /* Note that we can't release the inode based on only the file entry ref count because other file entries could be pointing to it
-                            Hence the in core inode should be released (entry set to NULL) only if the inode ref count is zero */
-                            if (process_table[i].fd_table[i]->inode->ref_count == 0)
-                                process_table[i].fd_table[i]->inode = NULL;
-                        }
-                    }
-                    process_table[i].state = UNUSED;
-                    process_table[i].daemon = false;
-                }
+            else if (process_table[i]->state == KILLED && signal == SIGHUP){
+                /* Release rogue or unattended zombie not owned by init. Zombies released already are only waiting for the worker */
+                if (process_table[i]->ppid != 1 && contains(&pc.zombies, (struct Node*)process_table[i]))
+                    defer_release(process_table[i]);
             }
         }
         /* Prepare to terminate the init and idle process, since a system wide SIGTERM implies a shutdown request */
         if (signal == SIGTERM){
-            (process_table+1)->signals |= (1 << signal);
-            process_table->signals |= (1 << signal);
+            process_table[1]->signals |= (1 << signal);
+            process_table[0]->signals |= (1 << signal);
         }
-        /* Reset the PID counter on a system wide hang up signal which suggests user log out */
+        /* Restart the PID search after init on a system wide hang up signal which suggests user log out. PIDs still taken are skipped */
         if (signal == SIGHUP)
-            pid_num = 2;
+            last_pid = 1;
         return 0;
     }
     if (pid == 0){ /* Send signal to all children */
-        for(int i = 2; i < PROC_TABLE_SIZE; i++)
+        for (struct Process* child = process->children; child != NULL; child = child->sibling_next)
         {
-            /* The signal is not meant for the process which sent it */
-            if (process_table[i].pid == process->pid)
-                continue;
-            if (!(process_table[i].state == UNUSED || process_table[i].state == KILLED) && 
-                process->pid == process_table[i].ppid){
+            if (!(child->state == UNUSED || child->state == KILLED)){
                 /* Discard pending continue signal on reception of the stop signal and vice versa */
                 if (signal == SIGSTOP || signal == SIGTSTP)
-                    process_table[i].signals &= ~(1 << SIGCONT);
+                    child->signals &= ~(1 << SIGCONT);
                 else if (signal == SIGCONT)
-                    process_table[i].signals &= ~((1 << SIGSTOP) | (1 << SIGTSTP));
-                process_table[i].signals |= (1 << signal);
+                    child->signals &= ~((1 << SIGSTOP) | (1 << SIGTSTP));
+                child->signals |= (1 << signal);
                 /* Wake up sleeping processes to act on the group signal */
-                if (process_table[i].state == SLEEP){
-                    remove(&pc.wait_list, (struct Node*)&process_table[i]);
-                    process_table[i].state = READY;
-                    push_back(&pc.ready_que, (struct Node*)&process_table[i]);
-                }
+                notify_process(child);
             }
         }
         return 0;
     }
     struct Process* target_proc = get_process(pid);
-    if (!target_proc)
+    if (!target_proc || target_proc->kthread)
         return -1;
     /* Discard pending continue signal on reception of the stop signal and vice versa */
     if (signal == SIGSTOP || signal == SIGTSTP)
@@ -800,11 +2191,48 @@ int kill(struct Process* process, int pid, int signal)
         target_proc->signals &= ~((1 << SIGSTOP) | (1 << SIGTSTP));
     target_proc->signals |= (1 << signal);
     /* Wake up the process if sleeping and place it on the ready queue, for it to act on the received signal */
-    if (target_proc->state == SLEEP){
-        remove(&pc.wait_list, (struct Node*)target_proc);
-        target_proc->state = READY;
-        push_back(&pc.ready_que, (struct Node*)target_proc);
-    }
+    notify_process(target_proc);
 
     return 0;
 }
+
+/* Create a kernel thread running fn(arg) at EL1. It is scheduled like a process and shows up in the process table, but runs on
+   empty translation tables like the idle processes. The value returned by fn is its exit status, init reaps it then
+   @param rt_priority Priority of the thread under SCHED_FIFO, or 0 for a time shared thread
+   @return the thread, or NULL if no PID or process table slot was left */
+struct Process* kthread_create(const char* name, KTHREAD_FUNC fn, void* arg, int rt_priority)
+{
+    struct Process* process;
+    int namelen = strlen(name);
+
+    process = alloc_new_process(false);
+    if (process == NULL)
+        return NULL;
+
+    process->page_map = (uint64_t)kzalloc_order(0);
+    ASSERT(process->page_map != 0);
+    memcpy(process->name, (char*)name, namelen < MAX_FILENAME_BYTES ? namelen : MAX_FILENAME_BYTES);
+    process->kthread = true;
+    process->daemon = true;
+    if (rt_priority != 0){
+        process->policy = SCHED_FIFO;
+        process->rt_priority = rt_priority;
+    }
+    /* The first switch to the thread returns to kthread_start instead of trap_return. The function and its argument
+       are handed over in x19 and x20 which swap restores along with x30 */
+    *(uint64_t*)(REGISTER_POSITION(process->sp, 0)) = (uint64_t)fn;
+    *(uint64_t*)(REGISTER_POSITION(process->sp, 1)) = (uint64_t)arg;
+    *(uint64_t*)(REGISTER_POSITION(process->sp, 11)) = (uint64_t)kthread_start;
+    process->state = READY;
+    enqueue_ready(process);
+
+    return process;
+}
+
+/* Terminate the current kernel thread once its function returned. It arrives here without the kernel lock and with interrupts enabled */
+void kthread_exit(int status)
+{
+    disable_irq();
+    lock_kernel();
+    exit(this_rq()->curr_process, status, false);
+}
@@ -19,6 +19,7 @@
 #ifndef PROCESS_H
 #define PROCESS_H
 
+#include <kernel.h>
 #include <irq/handler.h>
 #include <fs/file.h>
 #include <lib/lib.h>
@@ -26,9 +27,17 @@
 
 struct Process
 {
-    struct Node* next; /* Member needed for the scheduler to maintain a linked list of processes */
+    struct Node* next; /* Members needed for the scheduler to maintain the process queues. Must match the layout of struct Node */
+    struct Node* prev;
+    struct List* list; /* Queue the process is currently linked on */
+    struct Process* pid_next; /* Next process in the same PID hash bucket */
+    uint32_t slot; /* Index of the process in the process table */
+    struct Process* parent; /* Process on whose children list this one is linked, NULL if the parent is not around */
+    struct Process* children; /* First child process. Children are linked through their sibling members */
+    struct Process* sibling_next;
+    struct Process* sibling_prev;
     char name[MAX_FILENAME_BYTES+1];
-    uint64_t args;
+    uint64_t args; /* Kernel buffer holding the program arguments */
     uint32_t argc;
     int pid;
     int ppid;
@@ -36,40 +45,138 @@ struct Process
     int state;
     int status; /* Exit status of the process */
     bool daemon; /* Whether the process runs in the background as daemon */
+    bool kthread; /* Kernel thread running at EL1 on its kernel stack alone. It has no address space of its own and takes no signals */
+    bool reaped; /* Zombie taken out of sight by its parent and waiting on pc.reaped for its release */
     int jobs; /* Jobs created as a parent */
     int job_spec; /* Job specification as a child */
     int event; /* Event a process is waiting on */
+    int cpu; /* Core whose run queue the process was last queued on or ran on */
+    int priority; /* Scheduler level, 0 being the highest. The process is queued on the ready queue of this level */
+    uint32_t run_ticks; /* Ticks run at the current level, counted against the time quantum of the level */
+    int policy; /* Scheduling class, SCHED_OTHER for the time shared processes or one of the real-time classes SCHED_FIFO and SCHED_RR */
+    int rt_priority; /* Fixed priority of a real-time process from RT_PRIO_MIN to RT_PRIO_MAX, the higher the more urgent. 0 otherwise */
+    int nice; /* Niceness from NICE_MIN to NICE_MAX. It sets the weight of the process under the fair scheduler */
+    uint64_t vruntime; /* Run time scaled by the inverse of the weight. The fair scheduler runs the process with the least of it */
+    uint64_t exec_start; /* System count up to which the run time of the process has been added to its virtual runtime */
+    uint64_t slice_start; /* System count at which the process was last given the processor, which starts its time slice */
+    struct RbNode run_node; /* Node on the ready tree of the fair scheduler */
+    uint64_t utime; /* Time spent in user mode in system counts */
+    uint64_t stime; /* Time spent in the kernel, including the exceptions taken on behalf of the process */
+    uint64_t acct_stamp; /* System count up to which the time of the process has been accounted */
+    uint64_t wait_time; /* Time spent on a ready queue waiting for a core */
+    uint64_t max_wait; /* Longest single wait on a ready queue, i.e. the worst wakeup latency seen */
+    uint64_t ready_since; /* System count at which the process was last placed on a ready queue */
+    uint32_t nvcsw; /* Context switches away from the process because it gave up the processor */
+    uint32_t nivcsw; /* Context switches away from the process because it was preempted */
+    uint64_t wake_time; /* System count at which a process sleeping on SLEEP_SYSCALL is due */
+    uint32_t heap_pos; /* Position on the sleeper heap counted from 1, 0 while not on it */
     uint64_t env; /* Process environment */
     uint64_t sp; /* Process kernel stack pointer */
     uint64_t page_map;
+    struct Process* vm_lender; /* Parent whose address space a vfork child runs on until it calls exec or exits, NULL otherwise */
+    uint64_t asid; /* Address space ID in the low ASID_BITS tagged with the generation it was allocated in */
+    uint32_t image_cluster; /* First filesystem cluster of the program image backing the text and data pages */
+    uint32_t image_size; /* Size of the program image which is paged in on demand */
+    uint64_t brk; /* Program break i.e. the end of the user heap */
+    uint64_t mmap_top; /* End of the highest file mapping. The file mapping region is only scanned up to here */
     uint64_t stack; /* Process kernel stack address */
-    uint64_t heap; /* Process kernel heap address */
     uint32_t signals; /* Pending signals bit map */
     struct FileEntry* fd_table[100]; /* A user file desc table which contains pointers to global file table entries */
     struct ContextFrame* reg_context;
     SIGHANDLER handlers[TOTAL_SIGNALS];
 };
 
+#define SCHED_LEVELS 4
+#define SCHED_QUANTUM(level) (1U << (level)) /* Time quantum of a scheduler level in ticks. Lower levels run longer at a time */
+#define SCHED_BOOST_TICKS 100 /* Interval at which all processes are moved back to the highest level (1 s) */
+#define NICE_MIN -20
+#define NICE_MAX 19
+#define NICE_0_WEIGHT 1024 /* Weight of a process at niceness 0. Each step of niceness changes the weight by about 25% */
+#define SCHED_LATENCY_NS 40000000UL /* Period in which the fair scheduler runs every ready process once (40 ms) */
+#define SCHED_MIN_GRANULARITY_NS 10000000UL /* Shortest time slice of the fair scheduler. The period is stretched to keep slices at least this long */
+#define SCHED_WAKEUP_GRANULARITY_NS 10000000UL /* Virtual runtime lead a ready process needs over the running one to preempt it */
+#define SCHED_OTHER 0
+#define SCHED_FIFO 1
+#define SCHED_RR 2
+#define RT_PRIO_MIN 1
+#define RT_PRIO_MAX 31 /* Real-time priorities are kept in a bit map of 32 bits */
+#define SCHED_RR_TIMESLICE_NS 100000000UL /* Time slice of a round robin process among the ready ones of its priority (100 ms) */
+#define LOAD_FREQ 500 /* Interval of the load average samples in ticks (5 s) */
+#define LOAD_FSHIFT 11 /* Fraction bits of the fixed point load averages */
+#define LOAD_FIXED_1 (1 << LOAD_FSHIFT)
+#define WAIT_HASH_SIZE 8 /* Buckets of the wait queue hash. Must be a power of 2 large enough to keep the sleep events apart */
+#define WAIT_BUCKET(event) ((uint32_t)(event) & (WAIT_HASH_SIZE - 1))
+
+struct RunQueue
+{
+    struct Process* curr_process; /* Process running on the core */
+    struct Process* idle_process; /* Process the core runs when it has nothing else to do */
+    uint32_t nr_ready; /* Processes on the ready queue, real-time ones included */
+    uint32_t nr_rt; /* Real-time processes on the ready queue */
+    struct List rt_que[RT_PRIO_MAX+1]; /* Ready queue per real-time priority. They all run ahead of the time shared processes */
+    uint32_t rt_map; /* Bit n is set while the real-time queue of priority n is not empty */
+    bool need_resched; /* A process outranking the running one was queued. The core switches to it on its way out of the exception */
+#ifdef SCHED_CFS
+    struct RbTree ready_tree; /* Ready processes ordered by virtual runtime */
+    uint64_t min_vruntime; /* Monotonic floor of the virtual runtimes on the core. Processes joining the core are placed against it */
+    uint64_t load; /* Sum of the weights of the ready processes */
+#else
+    struct List ready_que[SCHED_LEVELS]; /* Ready queue per scheduler level */
+    uint32_t ready_map; /* Bit n is set while the ready queue of level n is not empty */
+    uint64_t charge_tick; /* Tick up to which the current process has been charged for its run time */
+#endif
+};
+
 struct ProcessControl
 {
-    struct Process* curr_process;
+    struct RunQueue run_que[NCPU]; /* Run queue per core */
     struct Process* fg_process; /* Current foreground process. This is not the same as current process */
-    struct List ready_que;
-    struct List wait_list;
+    struct List wait_que[WAIT_HASH_SIZE]; /* Wait queues hashed by the event the sleeping processes are waiting on */
+    uint32_t waiters; /* Number of processes sleeping on any of the wait queues */
     struct List suspended;
     struct List zombies; /* Processes that have exited and awaiting resource cleanup */
+    struct List reaped; /* Zombies taken out of sight and awaiting their release on a worker thread */
 };
 
-#define STACK_SIZE 0x21000 /* 132K */
-#define HEAP_SIZE 0x80000 /* 512K */
-#define DEF_BSS_SIZE 0x400 /* 1K */
-#define PROC_TABLE_SIZE 100
+/* CPU usage of a process as reported to userspace. Times are in nanoseconds */
+struct ProcStat
+{
+    uint64_t utime;
+    uint64_t stime;
+    uint64_t wait_time;
+    uint64_t max_wait;
+    uint32_t nvcsw;
+    uint32_t nivcsw;
+    int cpu;
+    int priority;
+    int nice;
+    int policy;
+    int rt_priority;
+};
+
+/* System wide scheduler statistics as reported to userspace. Times are in nanoseconds */
+struct SysStat
+{
+    uint64_t uptime;
+    uint64_t idle_time; /* Time all cores together spent idle */
+    uint32_t loadavg[3]; /* 1, 5 and 15 minute load averages in fixed point with LOAD_FSHIFT fraction bits */
+    uint32_t nr_running; /* Processes running or ready to run */
+    uint32_t nr_procs;
+    uint32_t ncpu;
+};
+
+#define STACK_SIZE 0x20000 /* 128K */
+#define PROC_TABLE_INIT_SIZE 64 /* Slots of the process table at boot. It doubles whenever it runs full */
+#define PID_MAX 32768 /* PIDs are handed out below this. It also bounds the size of the process table */
+#define PID_HASH_SIZE 64 /* Buckets of the PID hash index. Must be a power of 2 */
 #define USERSPACE_CONTEXT_SIZE (12*8) /* 12 GPRs saved on the stack when context switch done by scheduler (see swap function) */
 #define REGISTER_POSITION(addr, n) ((uint64_t)(addr) + (n*8)) /* Position of nth 8-byte register from current address */
 #define MAX_OPEN_FILES 100
 #define WNOHANG 1
 #define WUNTRACED 2
 
+typedef int (*KTHREAD_FUNC)(void* arg);
+
 enum En_SleepEvent
 {
     NONE = -255,
@@ -77,7 +184,9 @@ enum En_SleepEvent
     STATE_CHANGE,
     KEYBOARD_INPUT,
     DAEMON_INPUT,
-    FG_PAUSED
+    FG_PAUSED,
+    VFORK_DONE,
+    WORK_QUEUED
 };
 
 enum En_ProcessState
@@ -92,25 +201,50 @@ enum En_ProcessState
 };
 
 void init_process(void);
+void init_idle_process(void);
 void trigger_scheduler(void);
+void enqueue_ready(struct Process* process);
+bool dequeue_ready(struct Process* process);
+bool on_ready_que(struct Process* process);
+void enqueue_wait(struct Process* process);
+bool dequeue_wait(struct Process* process);
 void swap(uint64_t* prev_sp_addr, uint64_t curr_sp);
 void trap_return(void);
+void kthread_start(void);
 struct Process* get_curr_process(void);
+struct Process* get_cpu_process(int cpu);
+bool running_elsewhere(struct Process* process);
 struct Process *get_fg_process(void);
 struct Process* get_process(int pid);
 int get_status(int pid);
 int get_proc_data(int pid, int* ppid, int* state, int* job_spec, char* name, char* args_buf);
 int get_active_pids(struct Process* process, int* pid_list, int all);
+int get_proc_stat(int pid, struct ProcStat* stat);
+void get_sys_stat(struct SysStat* stat);
+void account_time(bool user);
+int set_nice(int pid, int nice);
+int set_scheduler(int pid, int policy, int rt_priority);
+int get_scheduler(int pid);
+bool need_resched(void);
 struct Process* find_job(int job_spec, int ppid);
 void move_to_fore(struct Process* process);
 void move_to_back(struct Process* process);
 void switch_parent(int curr_ppid, int new_ppid, bool transfer_jobs);
 void sleep(int event);
 void wake_up(int event);
+void wake_sleepers(uint64_t now);
+uint64_t next_wake_time(void);
+#ifdef TICKLESS
+uint64_t next_deadline(uint64_t now);
+#endif
 void exit(struct Process* process, int status, bool sig_handler_req);
 int wait(int pid, int* wstatus, int options);
 int fork(void);
+int vfork(void);
 int exec(struct Process* process, char* name, const char* args[]);
+int spawn(const char* path, const char* args[], const char* envp[]);
 int kill(struct Process* process, int pid, int signal);
+struct Process* kthread_create(const char* name, KTHREAD_FUNC fn, void* arg, int rt_priority);
+void kthread_exit(int status);
 
 #endif
\ No newline at end of file
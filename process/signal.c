@@ -46,7 +46,7 @@ void check_pending_signals(struct Process* process)
                 if (process->handlers[i] != NULL){
                     /* Custom handlers should be invoked in user mode only which can be deduced from the handler address */
                     if (user_handler = !((uint64_t)(process->handlers[i]) & KERNEL_BASE)){
-                        switch_vm(process->page_map);
+                        switch_vm(process);
                         int64_t el0_addr = process->reg_context->elr;
                         /* Enable the proxy handler to run on eret which will invoke custom handler and restore previous context */
                         process->reg_context->elr = (int64_t)proxy_handler;
@@ -75,10 +75,10 @@ void check_pending_signals(struct Process* process)
                 /* Clear the signal by XORing specific bit, now that it is addressed */
                 process->signals ^= (1 << i);
                 /* Restore process state if it was interrupted during a syscall */
-                if (contains(&pc->ready_que, (struct Node*)process) && (process->event != NONE && !user_handler)){
-                    remove(&pc->ready_que, (struct Node*)process);
+                if (on_ready_que(process) && (process->event != NONE && !user_handler)){
+                    dequeue_ready(process);
                     process->state = SLEEP;
-                    push_back(&pc->wait_list, (struct Node*)process);
+                    enqueue_wait(process);
                 }
             }
         }
@@ -94,10 +94,10 @@ void def_handler_entry(int signal)
     case SIGABRT:
     case SIGTERM: { /* Graceful termination where orphans are reassigned, parent informed and memory cleaned */
         /* Remove the process from applicable active queue */
-        if (contains(&pc->ready_que, (struct Node*)target_proc))
-            remove(&pc->ready_que, (struct Node*)target_proc);
-        else if (contains(&pc->wait_list, (struct Node*)target_proc))
-            remove(&pc->wait_list, (struct Node*)target_proc);
+        if (on_ready_que(target_proc))
+            dequeue_ready(target_proc);
+        else
+            dequeue_wait(target_proc);
         /* Invoke exit to do the rest */
         exit(target_proc, (1 << 8) | signal, true);
         break;
@@ -118,10 +118,10 @@ void def_handler_entry(int signal)
             remove(&pc->suspended, (struct Node*)target_proc);
         else{
             /* Remove the process from applicable active queue */
-            if (contains(&pc->ready_que, (struct Node*)target_proc))
-                remove(&pc->ready_que, (struct Node*)target_proc);
-            else if (contains(&pc->wait_list, (struct Node*)target_proc))
-                remove(&pc->wait_list, (struct Node*)target_proc);
+            if (on_ready_que(target_proc))
+                dequeue_ready(target_proc);
+            else
+                dequeue_wait(target_proc);
             /* Yield the current foreground status if holding one, for other processes to claim */
             if (pc->fg_process != NULL){
                 if (target_proc->pid == pc->fg_process->pid)
@@ -151,10 +151,10 @@ void def_handler_entry(int signal)
         if (target_proc->state == STOPPED)
             return;
         /* Remove the process from applicable active queue */
-        if (contains(&pc->ready_que, (struct Node*)target_proc))
-            remove(&pc->ready_que, (struct Node*)target_proc);
-        else if (contains(&pc->wait_list, (struct Node*)target_proc))
-            remove(&pc->wait_list, (struct Node*)target_proc);
+        if (on_ready_que(target_proc))
+            dequeue_ready(target_proc);
+        else
+            dequeue_wait(target_proc);
         target_proc->status |= 0x7f;
         /* Inform the parent and create job */
         struct Process* parent = get_process(target_proc->ppid);
@@ -191,23 +191,32 @@ void def_handler_entry(int signal)
             /* Restore the process' state based on the event field */
             if (target_proc->event == NONE){
                 target_proc->state = READY;
-                push_back(&pc->ready_que, (struct Node*)target_proc);
+                enqueue_ready(target_proc);
             }
             else{
                 /* Convert input event if foreground process */
                 if (!target_proc->daemon && target_proc->event == DAEMON_INPUT)
                     target_proc->event = KEYBOARD_INPUT;
                 target_proc->state = SLEEP;
-                push_back(&pc->wait_list, (struct Node*)target_proc);
+                enqueue_wait(target_proc);
             }
             /* Pause the current foreground process if signal is being handled for a foreground process */
             if (!target_proc->daemon){
                 if (pc->fg_process){
-                    pc->fg_process->state = SLEEP;
-                    pc->fg_process->event = FG_PAUSED;
-                    if (contains(&pc->ready_que, (struct Node*)pc->fg_process))
-                        remove(&pc->ready_que, (struct Node*)pc->fg_process);
-                    push_back(&pc->wait_list, (struct Node*)pc->fg_process);
+                    /* A process running on another core is only marked. It queues itself on the next scheduler run there */
+                    if (running_elsewhere(pc->fg_process)){
+                        pc->fg_process->state = SLEEP;
+                        pc->fg_process->event = FG_PAUSED;
+                        send_ipi(pc->fg_process->cpu);
+                    }
+                    else{
+                        /* It may already be sleeping on another event, in which case it moves to the queue of the new one */
+                        if (!dequeue_ready(pc->fg_process))
+                            dequeue_wait(pc->fg_process);
+                        pc->fg_process->state = SLEEP;
+                        pc->fg_process->event = FG_PAUSED;
+                        enqueue_wait(pc->fg_process);
+                    }
                 }
                 pc->fg_process = target_proc;
             }
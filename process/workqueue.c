@@ -0,0 +1,81 @@
+/**
+    Frostbyte kernel and operating system
+    Copyright (C) 2023  Amol Dhamale <amoldhamale1105@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "workqueue.h"
+#include "process.h"
+#include <debug/debug.h>
+#include <stddef.h>
+
+/* Workqueue for the work deferred by the kernel at large, served by the kworker thread. Work on it is kept short */
+static struct Workqueue system_wq;
+
+/* Body of a worker thread. Work runs with the kernel lock held like the rest of the kernel and may sleep
+   Interrupts are let in between two work items, which is where the worker can be preempted */
+static int worker_thread(void* arg)
+{
+    struct Workqueue* wq = (struct Workqueue*)arg;
+    struct Work* work;
+
+    while (1)
+    {
+        disable_irq();
+        lock_kernel();
+        while ((work = (struct Work*)pop_front(&wq->works)) == NULL)
+            sleep(WORK_QUEUED);
+        work->func(work);
+        unlock_kernel();
+        enable_irq();
+    }
+
+    return 0;
+}
+
+/* Set up an empty workqueue along with the kernel thread serving it
+   @param rt_priority SCHED_FIFO priority of the worker, 0 for a time shared worker
+   @return false if the thread could not be created */
+bool init_workqueue(struct Workqueue* wq, const char* name, int rt_priority)
+{
+    wq->works.head = wq->works.tail = NULL;
+    wq->worker = kthread_create(name, worker_thread, wq, rt_priority);
+
+    return wq->worker != NULL;
+}
+
+/* Queue work to be run by the worker thread of a workqueue. Safe to call from interrupt handlers
+   @return true if the work was queued, false if it was pending already */
+bool queue_work(struct Workqueue* wq, struct Work* work)
+{
+    if (work->list != NULL)
+        return false;
+    push_back(&wq->works, (struct Node*)work);
+    wake_up(WORK_QUEUED);
+
+    return true;
+}
+
+/* Queue work on the system workqueue */
+bool schedule_work(struct Work* work)
+{
+    return queue_work(&system_wq, work);
+}
+
+void init_workqueues(void)
+{
+    /* The system worker runs at the top real-time priority. Only a real-time process at that same priority can hold up its work */
+    ASSERT(init_workqueue(&system_wq, "kworker", RT_PRIO_MAX));
+}
@@ -0,0 +1,53 @@
+/**
+    Frostbyte kernel and operating system
+    Copyright (C) 2023  Amol Dhamale <amoldhamale1105@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <lib/lib.h>
+
+struct Work;
+struct Process;
+
+typedef void (*WORK_FUNC)(struct Work* work);
+
+/* Work deferred to a worker thread, e.g. by an interrupt handler. It stays linked on its workqueue until the worker picks it up,
+   hence a work item queued again before that runs once only */
+struct Work
+{
+    struct Node* next; /* Members needed to link the work on a workqueue. Must match the layout of struct Node */
+    struct Node* prev;
+    struct List* list;
+    WORK_FUNC func;
+};
+
+#define INIT_WORK(fn) { .next = NULL, .prev = NULL, .list = NULL, .func = (fn) }
+
+/* Queue of work served in order by a kernel thread of its own */
+struct Workqueue
+{
+    struct List works;
+    struct Process* worker;
+};
+
+void init_workqueues(void);
+bool init_workqueue(struct Workqueue* wq, const char* name, int rt_priority);
+bool queue_work(struct Workqueue* wq, struct Work* work);
+bool schedule_work(struct Work* work);
+
+#endif
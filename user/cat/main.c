@@ -74,15 +74,21 @@ int main(int argc, char** argv)
         return 1;
     }
     int file_size = get_file_size(fd);
-    char file_buf[file_size+1];
+    char* file_buf = malloc(file_size+1);
+    if (file_buf == NULL){
+        printf("%s: %s: File too large\n", argv[0], argv[filearg]);
+        return 1;
+    }
     int size_read = read_file(fd, file_buf, file_size);
     file_buf[file_size] = 0;
 
     if (file_size != size_read){
         printf("%s: %s: Error reading file\n", argv[0], argv[filearg]);
+        free(file_buf);
         return 1;
     }
     printf("%s", file_buf);
+    free(file_buf);
 
     return 0;
 }
\ No newline at end of file
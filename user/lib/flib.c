@@ -174,6 +174,39 @@ void sort(int *arr, size_t size)
     }
 }
 
+/* One letter code for a process state as shown by ps and top */
+char state_rep(int state)
+{
+    char state_ch;
+
+    switch (state)
+    {
+    case INIT:
+        state_ch = 'i';
+        break;
+    case RUNNING:
+        state_ch = 'R';
+        break;
+    case READY:
+        state_ch = 'r';
+        break;
+    case SLEEP:
+        state_ch = 's';
+        break;
+    case STOPPED:
+        state_ch = 'T';
+        break;
+    case KILLED:
+        state_ch = 'z';
+        break;
+    default:
+        state_ch = 0;
+        break;
+    }
+
+    return state_ch;
+}
+
 static int read_input(char* buf, int max_size)
 {
     char shell_echo[4];
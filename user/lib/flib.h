@@ -55,6 +55,46 @@ enum En_ProcessState
     KILLED
 };
 
+struct timespec {
+    int64_t tv_sec;
+    int64_t tv_nsec;
+};
+
+#define CLOCK_MONOTONIC 1
+
+/* CPU usage of a process. Times are in nanoseconds */
+struct proc_stat {
+    uint64_t utime;
+    uint64_t stime;
+    uint64_t wait_time; /* Time spent ready to run but waiting for a core */
+    uint64_t max_wait; /* Longest single wait for a core */
+    uint32_t nvcsw; /* Voluntary context switches */
+    uint32_t nivcsw; /* Involuntary context switches */
+    int cpu; /* Core the process last ran on */
+    int priority; /* Scheduler level, 0 being the highest */
+    int nice; /* Niceness from -20 to 19, setting the share of the processor under the fair scheduler */
+    int policy; /* Scheduling class, one of SCHED_OTHER, SCHED_FIFO and SCHED_RR */
+    int rt_priority; /* Real-time priority from 1 to 31, higher being more urgent. 0 for SCHED_OTHER */
+};
+
+/* System wide scheduler statistics. Times are in nanoseconds */
+struct sys_stat {
+    uint64_t uptime;
+    uint64_t idle_time; /* Time all cores together spent idle */
+    uint32_t loadavg[3]; /* 1, 5 and 15 minute load averages in fixed point with LOAD_FSHIFT fraction bits */
+    uint32_t nr_running;
+    uint32_t nr_procs;
+    uint32_t ncpu;
+};
+
+#define LOAD_FSHIFT 11
+
+#define SCHED_OTHER 0
+#define SCHED_FIFO 1 /* Real-time, runs until it blocks or a higher priority is ready */
+#define SCHED_RR 2 /* Real-time, also takes turns of 100 ms with the others of its priority */
+#define RT_PRIO_MIN 1
+#define RT_PRIO_MAX 31
+
 #define ENTRY_AVAILABLE 0
 #define ENTRY_DELETED 0xe5
 #define ATTR_VOLUME_LABEL 0x08
@@ -97,6 +137,11 @@ uint64_t atox(char* str);
 int64_t power(int base, int exp);
 int abs(int num);
 void sort(int* arr, size_t size);
+char state_rep(int state); /* One letter code for a process state, 0 for an unknown state */
+void* sbrk(int64_t increment);
+void* malloc(size_t size);
+void free(void* ptr);
+void* realloc(void* ptr, size_t size);
 
 /* System call library functions */
 
@@ -127,5 +172,17 @@ char *getenv(const char *name);
 int unsetenv(const char *name);
 int getfullenv(char** list);
 void switchpenv(void);
+void* brk(void* addr); /* Returns the resulting program break, or the current one if addr is NULL or out of range */
+void* mmap(int fd, uint32_t offset, uint32_t size); /* Maps a file read-only. Offset must be 4K aligned. Returns NULL on failure */
+int munmap(void* addr, uint32_t size);
+int clock_gettime(int clock_id, struct timespec* tp); /* Only CLOCK_MONOTONIC is supported */
+int nanosleep(const struct timespec* req, struct timespec* rem);
+int get_proc_stat(int pid, struct proc_stat* st);
+int get_sys_stat(struct sys_stat* st);
+int setpriority(int pid, int nice); /* PID 0 is the calling process. The niceness is clamped to -20..19 */
+int sched_setscheduler(int pid, int policy, int priority); /* Priority is 1..31 for the real-time classes and 0 for SCHED_OTHER */
+int sched_getscheduler(int pid);
+int vfork(void); /* The child runs on the memory and stack of the caller, which is suspended until the child calls exec or exit */
+int spawn(const char* path, const char* args[], const char* envp[]); /* Entries of envp are NAME=VALUE. NULL passes on the caller's environment */
 
 #endif
\ No newline at end of file
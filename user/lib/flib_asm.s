@@ -90,6 +90,18 @@
 .global unsetenv
 .global getfullenv
 .global switchpenv
+.global brk
+.global mmap
+.global munmap
+.global clock_gettime
+.global nanosleep
+.global get_proc_stat
+.global get_sys_stat
+.global setpriority
+.global sched_setscheduler
+.global sched_getscheduler
+.global vfork
+.global spawn
 
 memset:
     # x0 => dst x1 => value x2 => size
@@ -646,3 +658,226 @@ switchpenv:
     # Operating system trap
     svc #0
     ret
+
+brk:
+    # Allocate 8 bytes on the stack to accomodate the argument to this function
+    # Note that in aarch64, args to functions are loaded in GPRs not the stack
+    # We need the registers for other purposes hence saving the arg on the stack beforehand
+    sub sp, sp, #8
+    str x0, [sp]
+    # Set the syscall index to 26 (set program break) in x8
+    mov x8, #26
+    # Load the arg count in x0
+    mov x0, #1
+    # Load x1 with the pointer to the arguments i.e. the current stack pointer
+    mov x1, sp
+    # Operating system trap
+    svc #0
+
+    # Restore the stack
+    add sp, sp, #8
+    ret
+
+mmap:
+    # Allocate 24 bytes on the stack to accomodate the args to this function
+    # Note that in aarch64, args to functions are loaded in GPRs not the stack
+    # We need the registers for other purposes hence saving the args on the stack beforehand
+    sub sp, sp, #24
+    stp x0, x1, [sp]
+    str x2, [sp, #16]
+    # Set the syscall index to 27 (map file) in x8
+    mov x8, #27
+    # Load the arg count in x0
+    mov x0, #3
+    # Load x1 with the pointer to the arguments i.e. the current stack pointer
+    mov x1, sp
+    # Operating system trap
+    svc #0
+
+    # Restore the stack
+    add sp, sp, #24
+    ret
+
+munmap:
+    # Allocate 16 bytes on the stack to accomodate the args to this function
+    # Note that in aarch64, args to functions are loaded in GPRs not the stack
+    # We need the registers for other purposes hence saving the args on the stack beforehand
+    sub sp, sp, #16
+    stp x0, x1, [sp]
+    # Set the syscall index to 28 (unmap file) in x8
+    mov x8, #28
+    # Load the arg count in x0
+    mov x0, #2
+    # Load x1 with the pointer to the arguments i.e. the current stack pointer
+    mov x1, sp
+    # Operating system trap
+    svc #0
+
+    # Restore the stack
+    add sp, sp, #16
+    ret
+
+clock_gettime:
+    # Allocate 16 bytes on the stack to accomodate the args to this function
+    # Note that in aarch64, args to functions are loaded in GPRs not the stack
+    # We need the registers for other purposes hence saving the args on the stack beforehand
+    sub sp, sp, #16
+    stp x0, x1, [sp]
+    # Set the syscall index to 29 (read clock) in x8
+    mov x8, #29
+    # Load the arg count in x0
+    mov x0, #2
+    # Load x1 with the pointer to the arguments i.e. the current stack pointer
+    mov x1, sp
+    # Operating system trap
+    svc #0
+
+    # Restore the stack
+    add sp, sp, #16
+    ret
+
+nanosleep:
+    # Allocate 16 bytes on the stack to accomodate the args to this function
+    # Note that in aarch64, args to functions are loaded in GPRs not the stack
+    # We need the registers for other purposes hence saving the args on the stack beforehand
+    sub sp, sp, #16
+    stp x0, x1, [sp]
+    # Set the syscall index to 30 (high resolution sleep) in x8
+    mov x8, #30
+    # Load the arg count in x0
+    mov x0, #2
+    # Load x1 with the pointer to the arguments i.e. the current stack pointer
+    mov x1, sp
+    # Operating system trap
+    svc #0
+
+    # Restore the stack
+    add sp, sp, #16
+    ret
+
+get_proc_stat:
+    # Allocate 16 bytes on the stack to accomodate the args to this function
+    # Note that in aarch64, args to functions are loaded in GPRs not the stack
+    # We need the registers for other purposes hence saving the args on the stack beforehand
+    sub sp, sp, #16
+    stp x0, x1, [sp]
+    # Set the syscall index to 31 (process CPU usage) in x8
+    mov x8, #31
+    # Load the arg count in x0
+    mov x0, #2
+    # Load x1 with the pointer to the arguments i.e. the current stack pointer
+    mov x1, sp
+    # Operating system trap
+    svc #0
+
+    # Restore the stack
+    add sp, sp, #16
+    ret
+
+get_sys_stat:
+    # Allocate 8 bytes on the stack to accomodate the argument to this function
+    # Note that in aarch64, args to functions are loaded in GPRs not the stack
+    # We need the registers for other purposes hence saving the arg on the stack beforehand
+    sub sp, sp, #8
+    str x0, [sp]
+    # Set the syscall index to 32 (system load and uptime) in x8
+    mov x8, #32
+    # Load the arg count in x0
+    mov x0, #1
+    # Load x1 with the pointer to the arguments i.e. the current stack pointer
+    mov x1, sp
+    # Operating system trap
+    svc #0
+
+    # Restore the stack
+    add sp, sp, #8
+    ret
+
+setpriority:
+    # Allocate 16 bytes on the stack to accomodate the args to this function
+    # Note that in aarch64, args to functions are loaded in GPRs not the stack
+    # We need the registers for other purposes hence saving the args on the stack beforehand
+    sub sp, sp, #16
+    stp x0, x1, [sp]
+    # Set the syscall index to 33 (set niceness) in x8
+    mov x8, #33
+    # Load the arg count in x0
+    mov x0, #2
+    # Load x1 with the pointer to the arguments i.e. the current stack pointer
+    mov x1, sp
+    # Operating system trap
+    svc #0
+
+    # Restore the stack
+    add sp, sp, #16
+    ret
+
+sched_setscheduler:
+    # Allocate 24 bytes on the stack to accomodate the args to this function
+    # Note that in aarch64, args to functions are loaded in GPRs not the stack
+    # We need the registers for other purposes hence saving the args on the stack beforehand
+    sub sp, sp, #24
+    stp x0, x1, [sp]
+    str x2, [sp, #16]
+    # Set the syscall index to 34 (set scheduling class) in x8
+    mov x8, #34
+    # Load the arg count in x0
+    mov x0, #3
+    # Load x1 with the pointer to the arguments i.e. the current stack pointer
+    mov x1, sp
+    # Operating system trap
+    svc #0
+
+    # Restore the stack
+    add sp, sp, #24
+    ret
+
+sched_getscheduler:
+    # Allocate 8 bytes on the stack to accomodate the argument to this function
+    # Note that in aarch64, args to functions are loaded in GPRs not the stack
+    # We need the registers for other purposes hence saving the arg on the stack beforehand
+    sub sp, sp, #8
+    str x0, [sp]
+    # Set the syscall index to 35 (get scheduling class) in x8
+    mov x8, #35
+    # Load the arg count in x0
+    mov x0, #1
+    # Load x1 with the pointer to the arguments i.e. the current stack pointer
+    mov x1, sp
+    # Operating system trap
+    svc #0
+
+    # Restore the stack
+    add sp, sp, #8
+    ret
+
+vfork:
+    # No arguments to this syscall hence no stack space required
+    # The stack must not be touched either since the child runs on the stack of the parent until it calls exec or exit
+    # Set the syscall index to 36 (vfork) in x8
+    mov x8, #36
+    # Load the arg count in x0
+    mov x0, #0
+    # Operating system trap
+    svc #0
+    ret
+
+spawn:
+    # Allocate 24 bytes on the stack to accomodate the args to this function
+    # Note that in aarch64, args to functions are loaded in GPRs not the stack
+    # We need the registers for other purposes hence saving the args on the stack beforehand
+    sub sp, sp, #24
+    stp x0, x1, [sp]
+    str x2, [sp, #16]
+    # Set the syscall index to 37 (spawn) in x8
+    mov x8, #37
+    # Load the arg count in x0
+    mov x0, #3
+    # Load x1 with the pointer to the arguments i.e. the current stack pointer
+    mov x1, sp
+    # Operating system trap
+    svc #0
+
+    # Restore the stack
+    add sp, sp, #24
+    ret
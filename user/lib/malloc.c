@@ -0,0 +1,286 @@
+/**
+    Frostbyte kernel and operating system
+    Copyright (C) 2023  Amol Dhamale <amoldhamale1105@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "flib.h"
+#include <stdbool.h>
+
+/* Every heap block carries its size in a header word in front of the payload and a matching footer word at its end
+   The low bit of both words flags a block in use. The footers let a freed block merge with a free block lying just below it */
+#define BLOCK_USED          1UL
+#define BLOCK_ALIGN         16
+#define BLOCK_OVERHEAD      (2*sizeof(uint64_t))
+#define MIN_BLOCK_SIZE      (BLOCK_OVERHEAD + 2*sizeof(void*)) /* Free blocks hold the free list links in their payload */
+#define SIZE_CLASSES        14 /* Class i holds free blocks of size [32 << i, 32 << (i+1)) and the last class everything larger */
+#define HEAP_GROW_SIZE      0x4000 /* Minimum amount by which the heap is extended at a time (16K) */
+#define HEAP_TRIM_SIZE      0x10000 /* A free block at the top of the heap larger than this is handed back to the kernel (64K) */
+
+#define ALIGN_BLOCK(size)   (((uint64_t)(size) + BLOCK_ALIGN - 1) & ~(uint64_t)(BLOCK_ALIGN - 1))
+#define HEADER(payload)     ((uint64_t*)((char*)(payload) - sizeof(uint64_t)))
+#define PAYLOAD(header)     ((void*)((char*)(header) + sizeof(uint64_t)))
+#define BLOCK_SIZE(header)  (*(header) & ~BLOCK_USED)
+#define IS_USED(header)     (*(header) & BLOCK_USED)
+#define FOOTER(header)      ((uint64_t*)((char*)(header) + BLOCK_SIZE(header) - sizeof(uint64_t)))
+#define NEXT_BLOCK(header)  ((uint64_t*)((char*)(header) + BLOCK_SIZE(header)))
+#define PREV_FOOTER(header) ((uint64_t*)((char*)(header) - sizeof(uint64_t)))
+
+struct FreeBlock
+{
+    struct FreeBlock* next;
+    struct FreeBlock* prev;
+};
+
+/* End of the bss set by the linker script of every program. The heap starts past it */
+extern char bss_end[];
+
+static struct FreeBlock* free_lists[SIZE_CLASSES];
+static uint64_t* heap_top = NULL; /* Header of the zero sized end marker which closes the heap */
+
+void* sbrk(int64_t increment)
+{
+    char* curr_brk = brk(NULL);
+    char* new_brk;
+
+    /* The kernel places the initial break at the end of the program image. Move it past the bss before handing out memory */
+    if (curr_brk < bss_end){
+        curr_brk = brk(bss_end);
+        if (curr_brk != bss_end)
+            return (void*)-1;
+    }
+    if (increment == 0)
+        return curr_brk;
+    new_brk = brk(curr_brk + increment);
+    if (new_brk != curr_brk + increment)
+        return (void*)-1;
+
+    return curr_brk;
+}
+
+static int size_class(uint64_t size)
+{
+    int class = 0;
+
+    size /= MIN_BLOCK_SIZE;
+    while (size > 1 && class < SIZE_CLASSES-1)
+    {
+        size >>= 1;
+        class++;
+    }
+
+    return class;
+}
+
+static void set_block(uint64_t* header, uint64_t size, uint64_t used)
+{
+    *header = size | used;
+    *FOOTER(header) = size | used;
+}
+
+static void insert_free(uint64_t* header)
+{
+    int class = size_class(BLOCK_SIZE(header));
+    struct FreeBlock* block = PAYLOAD(header);
+
+    block->prev = NULL;
+    block->next = free_lists[class];
+    if (free_lists[class] != NULL)
+        free_lists[class]->prev = block;
+    free_lists[class] = block;
+}
+
+static void remove_free(uint64_t* header)
+{
+    int class = size_class(BLOCK_SIZE(header));
+    struct FreeBlock* block = PAYLOAD(header);
+
+    if (block->prev != NULL)
+        block->prev->next = block->next;
+    else
+        free_lists[class] = block->next;
+    if (block->next != NULL)
+        block->next->prev = block->prev;
+}
+
+/* Merge a free block which is not on any free list with its free neighbours
+   @return Header of the merged block */
+static uint64_t* coalesce(uint64_t* header)
+{
+    uint64_t size = BLOCK_SIZE(header);
+    uint64_t* next = NEXT_BLOCK(header);
+    uint64_t* prev_footer = PREV_FOOTER(header);
+
+    if (!IS_USED(next)){
+        remove_free(next);
+        size += BLOCK_SIZE(next);
+    }
+    if (!IS_USED(prev_footer)){
+        header = (uint64_t*)((char*)header - BLOCK_SIZE(prev_footer));
+        remove_free(header);
+        size += BLOCK_SIZE(prev_footer);
+    }
+    set_block(header, size, 0);
+
+    return header;
+}
+
+/* Extend the heap by at least size bytes and return the resulting free block at the top of the heap */
+static uint64_t* grow_heap(uint64_t size)
+{
+    uint64_t* header;
+    char* mem;
+
+    if (size < HEAP_GROW_SIZE)
+        size = HEAP_GROW_SIZE;
+    if (heap_top == NULL){
+        /* Start the heap with a used footer and the end marker so that blocks never merge across either end of the heap */
+        if ((void*)-1 == (mem = sbrk(0)))
+            return NULL;
+        if ((void*)-1 == sbrk(ALIGN_BLOCK(mem) - (uint64_t)mem + BLOCK_OVERHEAD))
+            return NULL;
+        mem = (char*)ALIGN_BLOCK(mem);
+        *(uint64_t*)mem = BLOCK_USED;
+        heap_top = (uint64_t*)(mem + sizeof(uint64_t));
+        *heap_top = BLOCK_USED;
+    }
+    if ((void*)-1 == sbrk(size))
+        return NULL;
+    /* The old end marker becomes the header of the new block and a new one is placed at the new end of the heap */
+    header = heap_top;
+    set_block(header, size, 0);
+    heap_top = NEXT_BLOCK(header);
+    *heap_top = BLOCK_USED;
+
+    return coalesce(header);
+}
+
+/* Hand a free block back to its free list after releasing the top part of it if it lies at the end of the heap and is large */
+static void release_block(uint64_t* header)
+{
+    uint64_t size = BLOCK_SIZE(header);
+
+    if (NEXT_BLOCK(header) == heap_top && size > HEAP_TRIM_SIZE){
+        set_block(header, HEAP_GROW_SIZE, 0);
+        heap_top = NEXT_BLOCK(header);
+        *heap_top = BLOCK_USED;
+        sbrk(-(int64_t)(size - HEAP_GROW_SIZE));
+    }
+    insert_free(header);
+}
+
+/* Mark a free block used and split off its tail as a new free block if it is large enough to hold one */
+static void *use_block(uint64_t* header, uint64_t size)
+{
+    uint64_t block_size = BLOCK_SIZE(header);
+
+    if (block_size - size >= MIN_BLOCK_SIZE){
+        set_block(header, size, BLOCK_USED);
+        set_block(NEXT_BLOCK(header), block_size - size, 0);
+        insert_free(NEXT_BLOCK(header));
+    }
+    else
+        set_block(header, block_size, BLOCK_USED);
+
+    return PAYLOAD(header);
+}
+
+static uint64_t request_size(size_t size)
+{
+    uint64_t block_size = ALIGN_BLOCK(size + BLOCK_OVERHEAD);
+    return block_size < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : block_size;
+}
+
+void* malloc(size_t size)
+{
+    uint64_t block_size;
+    uint64_t* header;
+    struct FreeBlock* block;
+
+    if (size == 0)
+        return NULL;
+    block_size = request_size(size);
+
+    /* First fit within the size class of the request and the larger classes. Every block of a larger class is big enough */
+    for (int class = size_class(block_size); class < SIZE_CLASSES; class++)
+    {
+        for (block = free_lists[class]; block != NULL; block = block->next)
+        {
+            header = HEADER(block);
+            if (BLOCK_SIZE(header) >= block_size){
+                remove_free(header);
+                return use_block(header, block_size);
+            }
+        }
+    }
+
+    if (NULL == (header = grow_heap(block_size)))
+        return NULL;
+
+    return use_block(header, block_size);
+}
+
+void free(void* ptr)
+{
+    uint64_t* header;
+
+    if (ptr == NULL)
+        return;
+    header = HEADER(ptr);
+    set_block(header, BLOCK_SIZE(header), 0);
+    release_block(coalesce(header));
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    uint64_t block_size, curr_size;
+    uint64_t* header, *next;
+    void* new_ptr;
+
+    if (ptr == NULL)
+        return malloc(size);
+    if (size == 0){
+        free(ptr);
+        return NULL;
+    }
+    header = HEADER(ptr);
+    curr_size = BLOCK_SIZE(header);
+    block_size = request_size(size);
+
+    /* Grow in place by taking over the free block that follows if the two together are large enough */
+    next = NEXT_BLOCK(header);
+    if (block_size > curr_size && !IS_USED(next) && curr_size + BLOCK_SIZE(next) >= block_size){
+        remove_free(next);
+        curr_size += BLOCK_SIZE(next);
+        set_block(header, curr_size, 0);
+    }
+    if (block_size <= curr_size){
+        use_block(header, block_size);
+        /* Merge a tail split off a shrinking block with a free block after it */
+        next = NEXT_BLOCK(header);
+        if (!IS_USED(next)){
+            remove_free(next);
+            insert_free(coalesce(next));
+        }
+        return ptr;
+    }
+
+    if (NULL == (new_ptr = malloc(size)))
+        return NULL;
+    memcpy(new_ptr, ptr, curr_size - BLOCK_OVERHEAD);
+    free(ptr);
+
+    return new_ptr;
+}
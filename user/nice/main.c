@@ -0,0 +1,85 @@
+/**
+    Frostbyte kernel and operating system
+    Copyright (C) 2023  Amol Dhamale <amoldhamale1105@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "flib.h"
+#include <stddef.h>
+
+static void print_usage(void)
+{
+    printf("Usage:");
+    printf("\tnice [OPTION] [COMMAND [ARG]...]\n");
+    printf("\tRun COMMAND with an adjusted niceness, which affects its share of the processor\n");
+    printf("\twhen the kernel is built with the fair scheduler. With no COMMAND, print the\n");
+    printf("\tcurrent niceness. Niceness ranges from -20 (most favorable) to 19. A process may\n");
+    printf("\tset the niceness of itself and of its descendants, a negative adj included\n\n");
+    printf("\t-h\tdisplay this help and exit\n");
+    printf("\t-n adj\tadd integer adj to the niceness (default 10)\n");
+}
+
+int main(int argc, char** argv)
+{
+    int adjustment = 10;
+    int cmd = 1;
+    struct proc_stat st;
+
+    if (argc > 1 && argv[1][0] == '-'){
+        if (argv[1][1] == 'h' && argv[1][2] == 0){
+            print_usage();
+            return 0;
+        }
+        if (argv[1][1] != 'n' || argv[1][2] != 0 || argc < 3){
+            printf("%s: bad usage\n", argv[0]);
+            printf("Try \'%s -h\' for more information\n", argv[0]);
+            return 1;
+        }
+        adjustment = atoi(argv[2]);
+        cmd = 3;
+    }
+    if (get_proc_stat(getpid(), &st) < 0)
+        return 1;
+    if (cmd >= argc){
+        printf("%d\n", st.nice);
+        return 0;
+    }
+    setpriority(0, st.nice + adjustment);
+
+    /* Program files are named in capitals with the .BIN extension on disk. The extension may be left out on the command line */
+    int namelen = strlen(argv[cmd]);
+    char progname[namelen + MAX_EXTNAME_BYTES + 2];
+    memcpy(progname, argv[cmd], namelen);
+    progname[namelen] = 0;
+    if (find('.', progname) < 0){
+        memcpy(progname + namelen, ".BIN", MAX_EXTNAME_BYTES + 1);
+        progname[namelen + MAX_EXTNAME_BYTES + 1] = 0;
+    }
+    to_upper_str(progname);
+    /* Same as on the shell, init and login are not to be started by the user */
+    if (memcmp(progname, "INIT.BIN", 9) == 0 || memcmp(progname, "LOGIN.BIN", 10) == 0){
+        printf("%s: %s - Operation not permitted\n", argv[0], progname);
+        return 1;
+    }
+    /* The niceness carries over to the program which replaces this one */
+    const char* args[argc - cmd];
+    for (int i = cmd + 1; i < argc; i++)
+        args[i - cmd - 1] = argv[i];
+    args[argc - cmd - 1] = NULL;
+    exec(progname, args);
+    printf("%s: %s: command not found\n", argv[0], argv[cmd]);
+
+    return 1;
+}
@@ -20,36 +20,15 @@
 #include <stddef.h>
 #include <stdbool.h>
 
-static char state_rep(int state)
+/* Print the CPU time of a process, i.e. its user and system time together, as minutes and seconds */
+static void print_cputime(int pid)
 {
-    char state_ch;
+    struct proc_stat st;
+    int secs = 0;
 
-    switch (state)
-    {
-    case INIT:
-        state_ch = 'i';
-        break;
-    case RUNNING:
-        state_ch = 'R';
-        break;
-    case READY:
-        state_ch = 'r';
-        break;
-    case SLEEP:
-        state_ch = 's';
-        break;
-    case STOPPED:
-        state_ch = 'T';
-        break;
-    case KILLED:
-        state_ch = 'z';
-        break;
-    default:
-        state_ch = 0;
-        break;
-    }
-
-    return state_ch;
+    if (get_proc_stat(pid, &st) == 0)
+        secs = (st.utime + st.stime) / 1000000000UL;
+    printf("%d:%s%d", secs / 60, secs % 60 < 10 ? "0" : "", secs % 60);
 }
 
 static void print_usage(void)
@@ -109,7 +88,7 @@ int main(int argc, char** argv)
         }
     }
 
-    const char* ff_header = "PID    PPID    STATE    CMD";
+    const char* ff_header = "PID    PPID    STATE    TIME    CMD";
     const char* sf_header = "PID    CMD";
     const char* header = full_format ? ff_header : sf_header;
     int header_len = strlen(header);
@@ -121,7 +100,11 @@ int main(int argc, char** argv)
     separator[header_len+1] = 0;
     
     int pid_count = get_active_procs(NULL, all);
-    int pid_list[pid_count];
+    int* pid_list = malloc(pid_count*sizeof(int));
+    if (pid_list == NULL){
+        printf("%s: out of memory\n", argv[0]);
+        return 1;
+    }
     if (rows == 0 || rows > pid_count)
         rows = pid_count;
     get_active_procs(pid_list, all);
@@ -139,7 +122,9 @@ int main(int argc, char** argv)
         if (full_format){
             char procargs[args_size];
             get_proc_data(pid_list[i], &ppid, &state, NULL, NULL, args_size > 0 ? procargs : NULL);
-            printf("%d\t%d\t%c\t%s ", pid_list[i], ppid, state_rep(state), procname);
+            printf("%d\t%d\t%c\t", pid_list[i], ppid, state_rep(state));
+            print_cputime(pid_list[i]);
+            printf("\t%s ", procname);
             args_pos = 0;
             /* Print the process arguments from the procargs buffer filled by the kernel */
             while (args_pos < args_size)
@@ -152,6 +137,7 @@ int main(int argc, char** argv)
         }
         printf("%d\t%s\n", pid_list[i], procname);
     }
+    free(pid_list);
     
     return 0;
 }
\ No newline at end of file
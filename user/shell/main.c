@@ -90,9 +90,9 @@ int main(int argc, char** argv)
                 printf("%s: command not found\n", echo_buf+cmd_pos);
             else{
                 close_file(fd);
-                int cmd_pid = fork();
-                if (cmd_pid == 0)
-                    exec(cmd_buf+cmd_pos, (const char**)args);
+                int cmd_pid = spawn(cmd_buf+cmd_pos, (const char**)args, NULL);
+                if (cmd_pid == -1)
+                    printf("%s: cannot execute\n", echo_buf+cmd_pos);
                 else{
                     /* Don't make the parent wait since it's a background process, so that the shell becomes available to subsequent commands */
                     if (arg_count > 0 && strlen(args[arg_count-1]) == 1 && args[arg_count-1][0] == '&'){
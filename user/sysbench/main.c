@@ -0,0 +1,113 @@
+/**
+    Frostbyte kernel and operating system
+    Copyright (C) 2023  Amol Dhamale <amoldhamale1105@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "flib.h"
+#include <stddef.h>
+
+#define NSEC_PER_SEC 1000000000UL
+
+static int noop(void)
+{
+    return 0;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* Time a number of calls of a function
+   @return the average time of a call in nanoseconds */
+static uint64_t time_calls(int (*fn)(void), int iterations)
+{
+    uint64_t start = now_ns();
+
+    for (int i = 0; i < iterations; i++)
+        fn();
+
+    return (now_ns() - start) / iterations;
+}
+
+static void print_usage(void)
+{
+    printf("Usage:");
+    printf("\tsysbench [OPTION]...\n");
+    printf("\tMeasure the round trip latency of a null system call (getpid). Build the kernel with\n");
+    printf("\tFAST_SYSCALL=0 and FAST_SYSCALL=1 to compare the full and the fast syscall path\n\n");
+    printf("\t-h\tdisplay this help and exit\n");
+    printf("\t-n num\tcalls per round (default 100000)\n");
+    printf("\t-r num\trounds, the best of which is reported (default 5)\n");
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = 100000;
+    int rounds = 5;
+    int opt = 1;
+    uint64_t loop, call, best = UINT64_MAX;
+
+    while (opt < argc)
+    {
+        if (argv[opt][0] != '-' || argv[opt][1] == 0 || argv[opt][2] != 0){
+            printf("%s: invalid option \'%s\'\n", argv[0], argv[opt]);
+            printf("Try \'%s -h\' for more information\n", argv[0]);
+            return 1;
+        }
+        switch (argv[opt][1])
+        {
+        case 'h':
+            print_usage();
+            return 0;
+        case 'n':
+        case 'r':
+            if (opt+1 >= argc || atoi(argv[opt+1]) <= 0){
+                printf("%s: option \'%s\' requires a positive number\n", argv[0], argv[opt]);
+                return 1;
+            }
+            if (argv[opt][1] == 'n')
+                iterations = atoi(argv[opt+1]);
+            else
+                rounds = atoi(argv[opt+1]);
+            opt++;
+            break;
+        default:
+            printf("%s: invalid option \'%s\'\n", argv[0], argv[opt]);
+            printf("Try \'%s -h\' for more information\n", argv[0]);
+            return 1;
+        }
+        opt++;
+    }
+
+    /* The cost of the loop and of calling a function is measured separately and taken off the syscall time */
+    loop = time_calls(noop, iterations);
+    printf("Round\tgetpid ns\n");
+    for (int round = 0; round < rounds; round++)
+    {
+        call = time_calls(getpid, iterations);
+        call = call > loop ? call - loop : 0;
+        if (call < best)
+            best = call;
+        printf("%d\t%u\n", round + 1, (uint32_t)call);
+    }
+    printf("Best\t%u\t(%d calls per round, loop overhead %u ns)\n", (uint32_t)best, iterations, (uint32_t)loop);
+
+    return 0;
+}
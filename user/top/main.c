@@ -0,0 +1,238 @@
+/**
+    Frostbyte kernel and operating system
+    Copyright (C) 2023  Amol Dhamale <amoldhamale1105@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "flib.h"
+#include <stddef.h>
+#include <stdbool.h>
+
+#define NSEC_PER_SEC 1000000000UL
+#define NSEC_PER_MSEC 1000000UL
+#define NSEC_PER_USEC 1000UL
+/* Room left in the PID list for processes created between counting the processes and listing them */
+#define PID_HEADROOM 16
+
+struct Sample {
+    int pid;
+    uint64_t cputime; /* User and system time at the previous refresh */
+    uint32_t usage; /* CPU usage since the previous refresh in tenths of a percent of one core */
+};
+
+/* Print the priority a process is scheduled at, the real-time priority prefixed with "rt" or the scheduler level otherwise */
+static void print_prio(const struct proc_stat* st)
+{
+    if (st->policy != SCHED_OTHER)
+        printf("rt%d", st->rt_priority);
+    else
+        printf("%d", st->priority);
+}
+
+static void print_two_digits(uint32_t val)
+{
+    printf("%s%u", val < 10 ? "0" : "", val);
+}
+
+/* Print a fixed point load average with two decimals */
+static void print_load(uint32_t load)
+{
+    printf("%u.", load >> LOAD_FSHIFT);
+    print_two_digits(((load & ((1 << LOAD_FSHIFT) - 1)) * 100) >> LOAD_FSHIFT);
+}
+
+static void print_uptime(uint64_t ns)
+{
+    uint32_t secs = ns / NSEC_PER_SEC;
+
+    printf("%u:", secs / 3600);
+    print_two_digits((secs / 60) % 60);
+    printf(":");
+    print_two_digits(secs % 60);
+}
+
+/* CPU time of the previous refresh for a process, 0 if the process is new */
+static uint64_t prev_cputime(struct Sample* samples, int count, int pid)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (samples[i].pid == pid)
+            return samples[i].cputime;
+    }
+    return 0;
+}
+
+/* Order the samples by CPU usage, the busiest process first. The lists are short enough for an insertion sort */
+static void sort_samples(struct Sample* samples, int count)
+{
+    struct Sample key;
+    int j;
+
+    for (int i = 1; i < count; i++)
+    {
+        key = samples[i];
+        for (j = i - 1; j >= 0 && samples[j].usage < key.usage; j--)
+            samples[j+1] = samples[j];
+        samples[j+1] = key;
+    }
+}
+
+static void print_usage(void)
+{
+    printf("Usage:");
+    printf("\ttop [OPTION...]\n");
+    printf("\tDisplay the processes using the processor the most, refreshed periodically\n\n");
+    printf("\t-h\tdisplay this help and exit\n");
+    printf("\t-d secs\tdelay between refreshes in seconds (default 3)\n");
+    printf("\t-n num\texit after num refreshes (default until interrupted)\n");
+}
+
+int main(int argc, char** argv)
+{
+    int delay = 3;
+    int iterations = 0;
+    int opt = 1;
+    while (opt < argc)
+    {
+        if (argv[opt][0] != '-' || argv[opt][1] == 0 || argv[opt][2] != 0){
+            printf("%s: bad usage\n", argv[0]);
+            printf("Try \'%s -h\' for more information\n", argv[0]);
+            return 1;
+        }
+        switch (argv[opt][1])
+        {
+        case 'h':
+            print_usage();
+            return 0;
+        case 'd':
+        case 'n':
+            if (opt+1 >= argc || atoi(argv[opt+1]) <= 0){
+                printf("%s: option \'%s\' requires a positive number\n", argv[0], argv[opt]);
+                return 1;
+            }
+            if (argv[opt][1] == 'd')
+                delay = atoi(argv[opt+1]);
+            else
+                iterations = atoi(argv[opt+1]);
+            opt++;
+            break;
+        default:
+            printf("%s: invalid option \'%s\'\n", argv[0], argv[opt]);
+            printf("Try \'%s -h\' for more information\n", argv[0]);
+            return 1;
+        }
+        opt++;
+    }
+
+    struct sys_stat sys;
+    struct proc_stat st;
+    struct Sample* prev = NULL;
+    struct Sample* curr;
+    int prev_count = 0;
+    int count;
+    int capacity;
+    int* pid_list;
+    uint64_t prev_uptime = 0;
+    uint64_t prev_idle = 0;
+    uint64_t elapsed;
+    uint64_t cputime;
+    uint64_t idle_pct;
+    struct timespec interval = {delay, 0};
+    int state;
+    char procname[MAX_FILENAME_BYTES+1];
+
+    for (int refresh = 0; iterations == 0 || refresh < iterations; refresh++)
+    {
+        get_sys_stat(&sys);
+        /* Other processes run between the two calls. The list is taken again should even the headroom not cover the new ones */
+        do
+        {
+            capacity = get_active_procs(NULL, 1) + PID_HEADROOM;
+            pid_list = malloc(capacity*sizeof(int));
+            curr = malloc(capacity*sizeof(struct Sample));
+            if (pid_list == NULL || curr == NULL){
+                printf("%s: out of memory\n", argv[0]);
+                free(pid_list);
+                free(curr);
+                free(prev);
+                return 1;
+            }
+            count = get_active_procs(pid_list, 1);
+            if (count > capacity){
+                free(pid_list);
+                free(curr);
+            }
+        } while (count > capacity);
+        /* Usage is measured over the time since the previous refresh, or since boot on the first one */
+        elapsed = sys.uptime - prev_uptime;
+        for (int i = 0; i < count; i++)
+        {
+            curr[i].pid = pid_list[i];
+            curr[i].cputime = 0;
+            if (get_proc_stat(pid_list[i], &st) == 0)
+                curr[i].cputime = st.utime + st.stime;
+            cputime = curr[i].cputime - prev_cputime(prev, prev_count, pid_list[i]);
+            curr[i].usage = elapsed ? (cputime * 1000) / elapsed : 0;
+        }
+        free(pid_list);
+        sort_samples(curr, count);
+
+        /* Clear the screen and move the cursor to the top left corner */
+        printf("\x1b[2J\x1b[H");
+        printf("top - up ");
+        print_uptime(sys.uptime);
+        printf(", %u cpus, load average: ", sys.ncpu);
+        print_load(sys.loadavg[0]);
+        printf(", ");
+        print_load(sys.loadavg[1]);
+        printf(", ");
+        print_load(sys.loadavg[2]);
+        printf("\nTasks: %u total, %u running\t", sys.nr_procs, sys.nr_running);
+        if (elapsed && sys.ncpu){
+            idle_pct = ((sys.idle_time - prev_idle) * 100) / (elapsed * sys.ncpu);
+            printf("Cpu(s): %u%c busy\n\n", idle_pct < 100 ? 100 - (uint32_t)idle_pct : 0, '%');
+        }
+        else
+            printf("\n\n");
+        /* The print library has no escape for a literal percent sign, hence it is passed as a character */
+        printf("PID\t%cCPU\tTIME\tWAIT ms\tMAXLAT us\tVCSW\tIVCSW\tPR\tNI\tC\tS\tCMD\n", '%');
+        for (int i = 0; i < count; i++)
+        {
+            if (get_proc_stat(curr[i].pid, &st) != 0)
+                continue;
+            memset(procname, 0, sizeof(procname));
+            get_proc_data(curr[i].pid, NULL, &state, NULL, procname, NULL);
+            printf("%d\t%u.%u\t", curr[i].pid, curr[i].usage / 10, curr[i].usage % 10);
+            cputime = (st.utime + st.stime) / NSEC_PER_SEC;
+            printf("%u:", (uint32_t)cputime / 60);
+            print_two_digits((uint32_t)(cputime % 60));
+            printf("\t%u\t%u\t\t", (uint32_t)(st.wait_time / NSEC_PER_MSEC), (uint32_t)(st.max_wait / NSEC_PER_USEC));
+            printf("%u\t%u\t", st.nvcsw, st.nivcsw);
+            print_prio(&st);
+            printf("\t%d\t%d\t%c\t%s\n", st.nice, st.cpu, state_rep(state), procname);
+        }
+
+        free(prev);
+        prev = curr;
+        prev_count = count;
+        prev_uptime = sys.uptime;
+        prev_idle = sys.idle_time;
+        if (iterations == 0 || refresh+1 < iterations)
+            nanosleep(&interval, NULL);
+    }
+    free(prev);
+
+    return 0;
+}